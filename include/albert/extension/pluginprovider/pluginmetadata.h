@@ -34,7 +34,9 @@ public:
     QStringList binary_dependencies;  ///< Required executables []
     QStringList third_party_credits;  ///< Third party credits and license notes []
     QStringList platforms;  ///< List of supported platforms. {Linux, Darwin,Windows}*. Empty means all.
+    QStringList plugin_dependencies;  ///< Ids of plugins that have to be loaded before this one []
     LoadType load_type = LoadType::User;  ///< See LoadType
+    bool thread_safe = false;  ///< Loading and PluginInstance::initialize may run in a background thread.
 };
 
 }
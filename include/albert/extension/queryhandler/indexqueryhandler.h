@@ -6,6 +6,7 @@
 #include <memory>
 #include <vector>
 class IndexQueryHandlerPrivate;
+class QueryEngine;
 
 namespace albert
 {
@@ -44,8 +45,22 @@ public:
     /// Set the items of the index. Call this in updateIndexItems(). @threadsafe
     void setIndexItems(std::vector<IndexItem>&&);
 
+    /// Add items to the index without rebuilding it. @threadsafe
+    /// The cost is proportional to the number of added items. Use this
+    /// instead of setIndexItems if only a few of your items changed.
+    void addIndexItems(std::vector<IndexItem>&&);
+
+    /// Remove the index items of the items having one of the given ids. @threadsafe
+    void removeIndexItems(const QStringList &item_ids);
+
+    /// Replace the index items of the items in the list. @threadsafe
+    /// Removes all index items of items having the same id and adds the
+    /// passed index items.
+    void replaceIndexItems(std::vector<IndexItem>&&);
+
 private:
     std::unique_ptr<IndexQueryHandlerPrivate> d;
+    friend class ::QueryEngine;
 };
 
 }
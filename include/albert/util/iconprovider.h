@@ -5,6 +5,8 @@
 #include <QPixmap>
 #include <QSize>
 #include <QStringList>
+#include <functional>
+class QObject;
 
 namespace albert{
 
@@ -58,9 +60,43 @@ public:
     /// [QColor::fromString]: https://doc.qt.io/qt/qcolor.html#fromString
     QPixmap getPixmap(const QString &url, QSize *size, const QSize &requestedSize) const;
 
+    /// Asynchronous pixmap providing function.
+    /// Like getPixmap(const QStringList &urls, QSize *size, const QSize &requestedSize) but
+    /// image files (file, xdg and qrc urls) are decoded in a background thread.
+    /// Concurrent requests for the same url share one decode. Call from the GUI thread only.
+    /// \param urls The URLs of the pixmap to be created.
+    /// \param requestedSize The size the pixmap should have if possible.
+    /// \param context ready is not called if context got destroyed. Must not be null.
+    /// \param ready Called in the GUI thread with the first pixmap available in the urls
+    /// list, null pixmap otherwise. Not called if the pixmap is returned immediately.
+    /// \returns The pixmap if it is cached or can be created immediately, a transparent
+    /// placeholder of requestedSize if ready will be called.
+    QPixmap getPixmapAsync(const QStringList &urls, const QSize &requestedSize, const QObject *context,
+                           std::function<void(const QPixmap &)> ready) const;
+
     /// Clears the internal icon cache
     void clearCache();
 
+    /// Sets the memory budget of the internal icon cache in bytes.
+    /// Least recently used pixmaps are evicted if it is exceeded.
+    void setCacheLimit(qint64 bytes);
+
+    /// The memory budget of the internal icon cache in bytes.
+    qint64 cacheLimit() const;
+
+    /// Diagnostics of the internal icon cache.
+    /// Pixmaps are cached per url, requested size and device pixel ratio.
+    struct CacheStatistics {
+        quint64 hits;
+        quint64 misses;
+        quint64 evictions;
+        qsizetype count;  ///< Number of cached pixmaps
+        qint64 size;  ///< Approximate memory used by the cached pixmaps in bytes
+    };
+
+    /// Returns the diagnostics of the internal icon cache.
+    CacheStatistics cacheStatistics() const;
+
 private:
     class Private;
     std::unique_ptr<Private> d;
@@ -4,22 +4,30 @@
 #include "albert/util/iconprovider.h"
 #include <QApplication>
 #include <QFileIconProvider>
+#include <QHashFunctions>
+#include <QImage>
 #include <QMetaEnum>
 #include <QPainter>
+#include <QPointer>
 #include <QRegularExpression>
 #include <QString>
 #include <QStyle>
+#include <QThreadPool>
 #include <QUrl>
 #include <QUrlQuery>
+#include <list>
 #include <mutex>
-#include <shared_mutex>
+#include <optional>
 #include <unordered_map>
+#include <vector>
 #if defined(Q_OS_LINUX) || defined(Q_OS_FREEBSD)
 #include "platform/Linux/xdg/iconlookup.h"
 #endif
 using namespace albert;
 using namespace std;
 
+static const qint64 DEFAULT_CACHE_LIMIT = 64 * 1024 * 1024;
+
 
 static QPixmap genericPixmap(int size, const QColor& bgcolor, const QColor& fgcolor, const QString& text, float scalar)
 {
@@ -54,37 +62,197 @@ static QPixmap genericPixmap(int size, const QColor& bgcolor, const QColor& fgco
 }
 
 
+namespace {
+
+struct CacheKey
+{
+    QString url;
+    QSize size;
+    qreal device_pixel_ratio;
+    bool operator==(const CacheKey &) const = default;
+};
+
+struct CacheKeyHash
+{
+    size_t operator()(const CacheKey &key) const
+    { return qHashMulti(0, key.url, key.size.width(), key.size.height(), key.device_pixel_ratio); }
+};
+
+}
+
 class IconProvider::Private
 {
     QFileIconProvider file_icon_provider;
 public:
-    mutable std::unordered_map<QString, QPixmap> pixmap_cache;
-    mutable std::shared_mutex mutex_;
+    using Callback = std::function<void(const QPixmap &)>;
+
+    // LRU cache, most recently used first
+    struct CacheEntry {
+        CacheKey key;
+        QPixmap pixmap;
+        qint64 cost;
+    };
+    mutable std::list<CacheEntry> cache;
+    mutable std::unordered_map<CacheKey, std::list<CacheEntry>::iterator, CacheKeyHash> cache_index;
+    mutable IconProvider::CacheStatistics statistics{};
+    qint64 cache_limit = DEFAULT_CACHE_LIMIT;
+    mutable std::mutex mutex_;
+
+    // Asynchronous decoding. GUI thread only, except for the decode jobs.
+    QObject receiver;  // Receives the decoded images in the GUI thread
+    std::unordered_map<CacheKey, std::vector<std::pair<QPointer<const QObject>, Callback>>, CacheKeyHash> pending;  // Waiters
+    QThreadPool decode_pool;  // Destructed first, i.e. waits for running decodes
+
+    // Whether the url refers to an image file, i.e. can be decoded in any thread
+    static bool isImageUrl(const QString &urlstr)
+    {
+        QUrl url(urlstr);
+        return url.scheme() == QStringLiteral("qrc") || urlstr.startsWith(':')
+#if defined(Q_OS_LINUX) || defined(Q_OS_FREEBSD)
+               || url.scheme() == QStringLiteral("xdg")
+#endif
+               || url.isLocalFile();
+    }
 
-    QPixmap getPixmapNoCache(const QString &urlstr, QSize *size, const QSize &requestedSize) const
+    // The path of the image file of an image url. Thread safe.
+    static QString imagePath(const QString &urlstr, const QSize &requestedSize)
     {
-        if (QUrl url(urlstr); url.scheme() == QStringLiteral("qrc") || urlstr.startsWith(':')){
+        if (QUrl url(urlstr); url.scheme() == QStringLiteral("qrc") || urlstr.startsWith(':'))
             // https://doc.qt.io/qt-6/qresource.html
-            if (auto pm = QPixmap(urlstr); !pm.isNull()){
+            return urlstr;
+#if defined(Q_OS_LINUX) || defined(Q_OS_FREEBSD)
+        else if (url.scheme() == QStringLiteral("xdg"))
+            // https://specifications.freedesktop.org/icon-theme-spec/icon-theme-spec-latest.html
+            return XDG::IconLookup::iconPath(url.toString(QUrl::RemoveScheme), requestedSize);
+#endif
+        else
+            return url.toLocalFile();
+    }
+
+    static CacheKey cacheKey(const QString &urlstr, const QSize &requestedSize)
+    { return {urlstr, requestedSize, qApp ? qApp->devicePixelRatio() : 1.0}; }
+
+    optional<QPixmap> cached(const CacheKey &key) const
+    {
+        std::lock_guard lock(mutex_);
+        if (auto it = cache_index.find(key); it != cache_index.end()) {
+            cache.splice(cache.begin(), cache, it->second);
+            ++statistics.hits;
+            return it->second->pixmap;
+        }
+        ++statistics.misses;
+        return {};
+    }
+
+    // Returns the cached pixmap, which is pm unless another thread was faster
+    QPixmap insert(const CacheKey &key, const QPixmap &pm) const
+    {
+        std::lock_guard lock(mutex_);
+        if (auto it = cache_index.find(key); it != cache_index.end())
+            return it->second->pixmap;
+
+        // Null pixmaps are cached too, at the cost of the key
+        const auto cost = (qint64)pm.width() * pm.height() * pm.depth() / 8
+                          + key.url.size() * (qint64)sizeof(QChar);
+        cache.push_front({key, pm, cost});
+        cache_index.emplace(key, cache.begin());
+        statistics.size += cost;
+        ++statistics.count;
+        evict();
+        return pm;
+    }
+
+    void evict() const  // Locked
+    {
+        while (statistics.size > cache_limit && !cache.empty()) {
+            statistics.size -= cache.back().cost;
+            --statistics.count;
+            ++statistics.evictions;
+            cache_index.erase(cache.back().key);
+            cache.pop_back();
+        }
+    }
+
+    QPixmap getPixmap(const QString &urlstr, QSize *size, const QSize &requestedSize) const
+    {
+        const auto key = cacheKey(urlstr, requestedSize);
+        if (auto pm = cached(key)) {
+            *size = pm->size();
+            return *pm;
+        }
+
+        // Do not block other requests while decoding
+        return insert(key, getPixmapNoCache(urlstr, size, requestedSize));
+    }
+
+    // Nullopt if ready will be called
+    optional<QPixmap> getPixmapAsync(QStringList urls, const QSize &requestedSize,
+                                     const QObject *context, Callback ready)
+    {
+        while (!urls.isEmpty()) {
+            const auto urlstr = urls.takeFirst();
+            const auto key = cacheKey(urlstr, requestedSize);
+
+            if (auto pm = cached(key)) {
+                if (!pm->isNull())
+                    return pm;
+
+            } else if (isImageUrl(urlstr)) {
+                // Fall back to the remaining urls if decoding fails
+                decode(key, context,
+                       [this, urls, requestedSize, context, ready](const QPixmap &pm){
+                    if (!pm.isNull())
+                        ready(pm);
+                    else if (auto next = getPixmapAsync(urls, requestedSize, context, ready))
+                        ready(*next);
+                });
+                return nullopt;
+
+            } else {
+                QSize size;
+                if (auto pm = insert(key, getPixmapNoCache(urlstr, &size, requestedSize)); !pm.isNull())
+                    return pm;
+            }
+        }
+        return QPixmap();
+    }
+
+    void decode(const CacheKey &key, const QObject *context, Callback ready)
+    {
+        auto &waiters = pending[key];
+        waiters.emplace_back(context, ::move(ready));
+        if (waiters.size() > 1)
+            return;  // Already decoding
+
+        decode_pool.start([this, key]{
+            // QPixmap is GUI thread only, QImage is not
+            QImage image(imagePath(key.url, key.size));
+
+            QMetaObject::invokeMethod(&receiver, [this, key, image]{
+                const auto pm = insert(key, QPixmap::fromImage(image));
+                auto waiters = ::move(pending.extract(key).mapped());
+                for (auto &[waiter_context, waiter_ready] : waiters)
+                    if (waiter_context)
+                        waiter_ready(pm);
+            }, Qt::QueuedConnection);
+        });
+    }
+
+    QPixmap getPixmapNoCache(const QString &urlstr, QSize *size, const QSize &requestedSize) const
+    {
+        if (isImageUrl(urlstr)){
+            if (auto pm = QPixmap(imagePath(urlstr, requestedSize)); !pm.isNull()){
                 *size = pm.size();
                 return pm;
             }
 
-        } else if (url.scheme() == QStringLiteral("qfip")){
+        } else if (QUrl url(urlstr); url.scheme() == QStringLiteral("qfip")){
             // https://doc.qt.io/qt-6/qfileiconprovider.html
             if (auto pm = file_icon_provider.icon(QFileInfo(url.toString(QUrl::RemoveScheme))).pixmap(requestedSize); !pm.isNull()){
                 *size = pm.size();
                 return pm;
             }
 
-#if defined(Q_OS_LINUX) || defined(Q_OS_FREEBSD)
-        } else if (url.scheme() == QStringLiteral("xdg")){
-            // https://specifications.freedesktop.org/icon-theme-spec/icon-theme-spec-latest.html
-            if (auto pm = QPixmap(XDG::IconLookup::iconPath(url.toString(QUrl::RemoveScheme))); !pm.isNull()){
-                *size = pm.size();
-                return pm;
-            }
-#endif
         } else if (url.scheme() == QStringLiteral("qsp")){
             // https://doc.qt.io/qt-6/qstyle.html#StandardPixmap-enum
             auto meta_enum = QMetaEnum::fromType<QStyle::StandardPixmap>();
@@ -98,12 +266,6 @@ public:
                 }
             WARN << "No such StandardPixmap found:" << name;
 
-        } else if (url.isLocalFile()){
-            if (auto pm = QPixmap(url.toLocalFile()); !pm.isNull()){
-                *size = pm.size();
-                return pm;
-            }
-
         } else if (url.scheme() == QStringLiteral("gen")){
             auto urlquery = QUrlQuery(url);
 
@@ -144,19 +306,46 @@ QPixmap IconProvider::getPixmap(const QStringList &urls, QSize *size, const QSiz
 
 QPixmap IconProvider::getPixmap(const QString &urlstr, QSize *size, const QSize &requestedSize) const
 {
-    try {
-        std::shared_lock lock(d->mutex_);
-        return d->pixmap_cache.at(urlstr);
-    } catch (const out_of_range &) {
-        std::unique_lock lock(d->mutex_);
-        return d->pixmap_cache.emplace(urlstr, d->getPixmapNoCache(urlstr, size, requestedSize)).first->second;
-    }
+    return d->getPixmap(urlstr, size, requestedSize);
+}
+
+QPixmap IconProvider::getPixmapAsync(const QStringList &urls, const QSize &requestedSize,
+                                     const QObject *context, std::function<void(const QPixmap &)> ready) const
+{
+    if (auto pm = d->getPixmapAsync(urls, requestedSize, context, ::move(ready)))
+        return *pm;
+
+    QPixmap placeholder(requestedSize);
+    placeholder.fill(Qt::transparent);
+    return placeholder;
 }
 
 void IconProvider::clearCache()
 {
-    std::unique_lock lock(d->mutex_);
-    d->pixmap_cache.clear();
+    std::lock_guard lock(d->mutex_);
+    d->cache.clear();
+    d->cache_index.clear();
+    d->statistics.size = 0;
+    d->statistics.count = 0;
+}
+
+void IconProvider::setCacheLimit(qint64 bytes)
+{
+    std::lock_guard lock(d->mutex_);
+    d->cache_limit = bytes;
+    d->evict();
+}
+
+qint64 IconProvider::cacheLimit() const
+{
+    std::lock_guard lock(d->mutex_);
+    return d->cache_limit;
+}
+
+IconProvider::CacheStatistics IconProvider::cacheStatistics() const
+{
+    std::lock_guard lock(d->mutex_);
+    return d->statistics;
 }
 
 
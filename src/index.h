@@ -2,6 +2,7 @@
 
 #pragma once
 #include <QString>
+#include <QStringList>
 #include <vector>
 namespace albert {
     class RankItem;
@@ -14,4 +15,6 @@ public:
     virtual ~Index() = default;
     virtual std::vector<albert::RankItem> search(const QString &string, const bool &isValid) const = 0;
     virtual void setItems(std::vector<albert::IndexItem> &&) = 0;
+    virtual void updateItems(const QStringList &removed_item_ids, std::vector<albert::IndexItem> &&added) = 0;
+    virtual size_t memoryUsage() const = 0;
 };
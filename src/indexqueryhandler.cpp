@@ -1,15 +1,82 @@
 // Copyright (c) 2023 Manuel Schneider
 
+#include "albert/albert.h"
 #include "albert/extension/queryhandler/indexqueryhandler.h"
+#include "albert/logging.h"
+#include "albert/util/timeprinter.h"
 #include "indexqueryhandlerprivate.h"
 #include "itemindex.h"
-#include <mutex>
+#include <QDir>
+#include <QThreadPool>
+#include <memory>
 using namespace std;
 using namespace albert;
 static const uint GRAM_SIZE = 2;
 //static const char* CFG_SEPARATORS = "separators";
 static const char* DEF_SEPARATORS = R"R([\s\\\/\-\[\](){}#!?<>"'=+*.:,;_]+)R";
 static const uint DEF_ERROR_TOLERANCE_DIVISOR = 4;
+static const char* SNAPSHOT_DIR = "indices";
+
+static QString snapshotPath(const QString &id)
+{ return QDir(QDir(cacheLocation()).filePath(SNAPSHOT_DIR)).filePath(id + ".index"); }
+
+static void saveSnapshot(const ItemIndex &index, const QString &id)
+{
+    TimePrinter tp(QString("[%1 ms] spent saving the index snapshot [%2]").arg("%1", id));
+    if (!QDir(cacheLocation()).mkpath(SNAPSHOT_DIR) || !index.saveSnapshot(snapshotPath(id)))
+        WARN << QString("Failed to save the index snapshot [%1]").arg(id);
+}
+
+// Persists the index on the thread pool. Requests coalesce while a save is queued.
+static void saveSnapshotLater(IndexQueryHandlerPrivate &d, const QString &id)
+{
+    lock_guard lock(d.snapshot_mutex);
+    if (!d.snapshot_saving || d.snapshot_save_queued)
+        return;
+    d.snapshot_save_queued = true;
+    ++d.snapshot_saves;
+
+    QThreadPool::globalInstance()->start([&d, id]{
+        shared_ptr<ItemIndex> index;
+        {
+            lock_guard lock_(d.snapshot_mutex);
+            d.snapshot_save_queued = false;
+            d.snapshot_dirty = false;
+            index = dynamic_pointer_cast<ItemIndex>(atomic_load(&d.index));
+        }
+
+        if (index)
+            saveSnapshot(*index, id);
+
+        lock_guard lock_(d.snapshot_mutex);
+        --d.snapshot_saves;
+        d.snapshot_saved.notify_all();
+    });
+}
+
+// Saving merges all segments and rewrites the file. Incremental updates are
+// saved with the next rebuild or when saving gets disabled instead.
+static void markSnapshotDirty(IndexQueryHandlerPrivate &d, const QString &id)
+{
+    lock_guard lock(d.snapshot_mutex);
+    d.snapshot_dirty = true;
+    d.snapshot_id = id;
+}
+
+void IndexQueryHandlerPrivate::setSnapshotSaving(bool enabled)
+{
+    unique_lock lock(snapshot_mutex);
+    snapshot_saving = enabled;
+    if (enabled)
+        return;
+
+    snapshot_saved.wait(lock, [this]{ return snapshot_saves == 0; });
+    if (snapshot_dirty) {
+        snapshot_dirty = false;
+        if (auto item_index = dynamic_pointer_cast<ItemIndex>(atomic_load(&index)))
+            saveSnapshot(*item_index, snapshot_id);
+    }
+}
 
 IndexQueryHandler::IndexQueryHandler() : d(new IndexQueryHandlerPrivate)
 {
@@ -18,22 +85,52 @@ IndexQueryHandler::IndexQueryHandler() : d(new IndexQueryHandlerPrivate)
     public:
         vector<RankItem> search(const QString&, const bool&) const override { return {}; }
         void setItems(vector<IndexItem> &&) override {}
+        void updateItems(const QStringList &, vector<IndexItem> &&) override {}
+        size_t memoryUsage() const override { return 0; }
     };
-    d->index = make_unique<NullIndex>();
+    d->index = make_shared<NullIndex>();
 }
 
-IndexQueryHandler::~IndexQueryHandler() = default;
+IndexQueryHandler::~IndexQueryHandler()
+{
+    // Saves capture d. Usually none is left, see setSnapshotSaving.
+    unique_lock lock(d->snapshot_mutex);
+    d->snapshot_saved.wait(lock, [this]{ return d->snapshot_saves == 0; });
+}
 
 void IndexQueryHandler::setIndexItems(vector<IndexItem> &&index_items)
 {
-    unique_lock l(d->index_mutex);
-    d->index->setItems(::move(index_items));
+    auto index = atomic_load(&d->index);
+    index->setItems(::move(index_items));
+    DEBG << QString("Index memory usage: %1 KiB [%2]").arg(index->memoryUsage() / 1024).arg(id());
+    saveSnapshotLater(*d, id());
+}
+
+void IndexQueryHandler::addIndexItems(vector<IndexItem> &&index_items)
+{
+    atomic_load(&d->index)->updateItems({}, ::move(index_items));
+    markSnapshotDirty(*d, id());
+}
+
+void IndexQueryHandler::removeIndexItems(const QStringList &item_ids)
+{
+    atomic_load(&d->index)->updateItems(item_ids, {});
+    markSnapshotDirty(*d, id());
+}
+
+void IndexQueryHandler::replaceIndexItems(vector<IndexItem> &&index_items)
+{
+    QStringList item_ids;
+    for (const auto &index_item : index_items)
+        item_ids << index_item.item->id();
+    item_ids.removeDuplicates();
+    atomic_load(&d->index)->updateItems(item_ids, ::move(index_items));
+    markSnapshotDirty(*d, id());
 }
 
 vector<RankItem> IndexQueryHandler::handleGlobalQuery(const GlobalQuery *query) const
 {
-    shared_lock l(d->index_mutex);
-    return d->index->search(query->string(), query->isValid());
+    return atomic_load(&d->index)->search(query->string(), query->isValid());
 }
 
 QString IndexQueryHandler::synopsis() const { return QStringLiteral("<filter>"); }
@@ -45,11 +142,15 @@ bool IndexQueryHandler::fuzzyMatching() const { return d->fuzzy; }
 void IndexQueryHandler::setFuzzyMatching(bool value)
 {
     d->fuzzy = value;
-    d->index_mutex.lock();
-    d->index = make_unique<ItemIndex>(
+    auto index = make_shared<ItemIndex>(
         DEF_SEPARATORS, false, GRAM_SIZE,
         value ? DEF_ERROR_TOLERANCE_DIVISOR : 0
     );
-    d->index_mutex.unlock();
+
+    // Serve the items of the last session until updateIndexItems rebuilt the index
+    if (index->loadSnapshot(snapshotPath(id())))
+        DEBG << QString("Loaded index snapshot, %1 KiB mapped [%2]").arg(index->memoryUsage() / 1024).arg(id());
+
+    atomic_store(&d->index, static_pointer_cast<Index>(index));
     updateIndexItems();
 }
@@ -3,16 +3,29 @@
 #pragma once
 #include "index.h"
 #include <QString>
+#include <condition_variable>
 #include <memory>
-#include <shared_mutex>
+#include <mutex>
 using namespace albert;
 using namespace std;
 
 class IndexQueryHandlerPrivate final
 {
 public:
-    unique_ptr<Index> index;
-    shared_mutex index_mutex;
+    shared_ptr<Index> index;  // Access using atomic_load/store only
     bool fuzzy;
-};
 
+    // Snapshot saves on the thread pool, see IndexQueryHandler::setIndexItems
+    mutex snapshot_mutex;
+    condition_variable snapshot_saved;
+    uint snapshot_saves = 0;  // Queued or running
+    bool snapshot_save_queued = false;
+    bool snapshot_dirty = false;  // Incremental updates not saved yet
+    bool snapshot_saving = true;
+    QString snapshot_id;
+
+    // Saves read the items. Disable saving while the handler and its items
+    // are alive, i.e. before it gets destroyed. Disabling waits for queued
+    // saves and saves pending incremental updates.
+    void setSnapshotSaving(bool enabled);
+};
@@ -3,46 +3,192 @@
 #include "albert/extension/queryhandler/indexitem.h"
 #include "albert/extension/queryhandler/item.h"
 #include "albert/extension/queryhandler/rankitem.h"
+#include "albert/extension/queryhandler/standarditem.h"
 #include "itemindex.h"
 #include "levenshtein.h"
-#include <QRegularExpression>
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <array>
+#include <cstring>
+#include <limits>
 #include <map>
+#include <numeric>
+#include <queue>
 #include <algorithm>
+#include <ranges>
+#include <stdexcept>
+#include <unordered_map>
 #include <utility>
-#include <mutex>
 using namespace std;
 using namespace albert;
+static const size_t MIN_STRINGS_PER_SHARD = 10000;
+static const size_t MIN_WORDS_PER_CHUNK = 10000;
+static const size_t SEARCH_CACHE_SIZE = 16;
 
+struct ItemIndex::CachedSearch
+{
+    weak_ptr<const Snapshot> snapshot;  // The index generation searched
+    vector<QString> words;
+    vector<vector<WordMatches>> word_matches;  // Per segment and word, up to the first word without matches
+    vector<RankItem> result;
+};
+
+namespace {
+
+// Item restored from a snapshot. Forwards the actions of the item having the
+// same id, once the index got rebuilt.
+class SnapshotItem : public StandardItem
+{
+public:
+    SnapshotItem(QString id, QString text, QString subtext, QString input_action_text, QStringList icon_urls,
+                 weak_ptr<const ItemIndex> index)
+        : StandardItem(::move(id), ::move(text), ::move(subtext), ::move(input_action_text), ::move(icon_urls)),
+          index_(::move(index)) {}
+
+    vector<Action> actions() const override
+    {
+        if (auto index = index_.lock())
+            if (auto item = index->item(id_))
+                return item->actions();
+        return {};
+    }
 
-static QStringList splitString(const QString &string, const QString &separators, bool case_sensitive = false)
+private:
+    weak_ptr<const ItemIndex> index_;
+};
+
+// Snapshot file layout: header, tables (8 byte aligned), serialized items.
+// Native byte order, the file is a cache of the local machine.
+struct SnapshotHeader
 {
-    return ((!case_sensitive) ? string.toLower(): string).split(QRegularExpression(separators), Qt::SkipEmptyParts);
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t n;
+    uint32_t error_tolerance_divisor;
+    uint32_t case_sensitive;
+    uint32_t reserved;
+    struct { uint64_t offset; uint64_t size; } sections[9];  // Tables in IndexTables order, then the items
+};
+
+const char SNAPSHOT_MAGIC[8] = "ALBIDX";
+const uint32_t SNAPSHOT_VERSION = 1;
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
 }
 
-static vector<QString> ngrams_for_word(const QString &word, uint n)
+
+/// Packs the n-grams of the (n-1 space padded) word into integer keys
+static vector<uint64_t> ngrams_for_word(QStringView word, uint n)
 {
-    vector<QString> ngrams;
+    vector<uint64_t> ngrams;
     ngrams.reserve(word.size());
-    auto padded = QString("%1%2").arg(QString(n - 1, ' '), word);
-    for (int i = 0; i < word.size(); ++i){
-        QString ngram{padded.mid(i, n)};
-        ngram.shrink_to_fit();
-        ngrams.emplace_back(ngram);
+    const uint64_t mask = n < 4 ? ((uint64_t)1 << (16 * n)) - 1 : ~(uint64_t)0;
+    uint64_t key = 0;
+    for (uint i = 1; i < n; ++i)
+        key = (key << 16) | u' ';
+    for (const QChar &c : word){
+        key = ((key << 16) | c.unicode()) & mask;
+        ngrams.emplace_back(key);
     }
     return ngrams;
 }
 
 ItemIndex::ItemIndex(QString sep, bool cs, uint n_, uint etd)
-    : case_sensitive(cs), error_tolerance_divisor(etd), separators(std::move(sep)), n(n_)
+    : snapshot(make_shared<const Snapshot>()), separators(sep), case_sensitive(cs),
+      tokenizer(sep, cs), error_tolerance_divisor(etd), n(n_)
 {
+    if (error_tolerance_divisor && (n < 1 || n > 4))
+        throw invalid_argument("ItemIndex: n-gram size has to be in the range [1,4].");
 }
 
-void ItemIndex::setItems(std::vector<albert::IndexItem> &&index_items)
+ItemIndex::IndexData::IndexData(IndexTables &&t) : items(::move(t.items))
 {
-    IndexData index_;
+    auto tables = make_shared<const IndexTables>(::move(t));
+    strings = tables->strings;
+    word_chars = tables->word_chars;
+    word_offsets = tables->word_offsets;
+    word_occurrences = tables->word_occurrences;
+    word_occurrence_offsets = tables->word_occurrence_offsets;
+    ngram_keys = tables->ngram_keys;
+    ngram_occurrences = tables->ngram_occurrences;
+    ngram_occurrence_offsets = tables->ngram_occurrence_offsets;
+    storage = ::move(tables);
+}
+
+ItemIndex::Index ItemIndex::IndexData::wordCount() const
+{
+    return word_offsets.empty() ? 0 : (Index)word_offsets.size() - 1;
+}
+
+QStringView ItemIndex::IndexData::word(Index i) const
+{
+    return QStringView(word_chars.data() + word_offsets[i], word_offsets[i+1] - word_offsets[i]);
+}
+
+const unordered_multimap<QString, ItemIndex::Index> &ItemIndex::IndexData::itemIds() const
+{
+    if (item_ids.empty())
+        for (Index i = 0; i < (Index)items.size(); ++i)
+            item_ids.emplace(items[i]->id(), i);
+    return item_ids;
+}
+
+size_t ItemIndex::IndexData::memoryUsage() const
+{
+    return items.capacity() * sizeof(decltype(items)::value_type)
+           + strings.size_bytes()
+           + word_chars.size_bytes()
+           + word_offsets.size_bytes()
+           + word_occurrences.size_bytes()
+           + word_occurrence_offsets.size_bytes()
+           + ngram_keys.size_bytes()
+           + ngram_occurrences.size_bytes()
+           + ngram_occurrence_offsets.size_bytes();
+}
+
+ItemIndex::IndexTables ItemIndex::buildIndex(std::vector<albert::IndexItem> &&index_items) const
+{
+    // Tokenize large item sets in shards on the thread pool and merge the sorted partial word tables
+    const auto shard_count = min<size_t>(QThreadPool::globalInstance()->maxThreadCount(),
+                                         index_items.size() / MIN_STRINGS_PER_SHARD);
+    if (shard_count < 2) {
+        IndexTables index_ = buildWordIndex(::move(index_items));
+        buildNGramIndex(index_);
+        return index_;
+    }
+
+    struct Shard { vector<albert::IndexItem> index_items; IndexTables index; };
+    vector<Shard> shards(shard_count);
+    for (size_t s = 0; s < shard_count; ++s)
+        shards[s].index_items.assign(make_move_iterator(index_items.begin() + s * index_items.size() / shard_count),
+                                     make_move_iterator(index_items.begin() + (s + 1) * index_items.size() / shard_count));
+    index_items.clear();
+
+    QtConcurrent::blockingMap(shards, [this](Shard &shard){ shard.index = buildWordIndex(::move(shard.index_items)); });
+
+    // Shards are contiguous, hence merging them in order yields the same index a single thread would have built.
+    vector<Segment> parts;
+    vector<const Segment*> part_pointers;
+    parts.reserve(shard_count);
+    for (auto &shard : shards)
+        part_pointers.emplace_back(&parts.emplace_back(::move(shard.index)));
+    shards.clear();
+
+    return mergeIndices(part_pointers);
+}
+
+ItemIndex::IndexTables ItemIndex::buildWordIndex(std::vector<albert::IndexItem> &&index_items) const
+{
+    IndexTables index_;
 
     unordered_map<albert::Item*,Index> item_indices_;  // implicit unique
-    map<QString,WordIndexItem> word_index_;  // implicit lexicographical order
+    map<QString,vector<Location>,less<>> word_index_;  // implicit lexicographical order
+    QString buffer;
+    vector<QStringView> words;
 
     for (Index string_index = 0; string_index < (Index)index_items.size(); ++string_index) {
 
@@ -55,83 +201,490 @@ void ItemIndex::setItems(std::vector<albert::IndexItem> &&index_items)
             item_index = it->second;
 
         // Add a string index entry for each string. Store the maximal match length for scoring
-        QStringList &&words = splitString(index_items[string_index].string, separators, case_sensitive);
+        tokenizer.tokenize(index_items[string_index].string, buffer, words);
         uint max_match_len = 0;
         for (const auto& word : words)
             max_match_len += word.size();
         index_.strings.emplace_back(item_index, max_match_len);
 
         // Add this string to the occurences in the word index.
-        for (Position pos = 0; pos < (Position)words.size(); ++pos)
-            word_index_[words[pos]].occurrences.emplace_back(string_index, pos);
+        for (Position pos = 0; pos < (Position)words.size(); ++pos) {
+            auto word_it = word_index_.lower_bound(words[pos]);
+            if (word_it == word_index_.end() || word_it->first != words[pos])
+                word_it = word_index_.emplace_hint(word_it, words[pos].toString(), vector<Location>());
+            word_it->second.emplace_back(string_index, pos);
+        }
     }
     index_.items.shrink_to_fit();
     index_.strings.shrink_to_fit();
 
-    // Build the random access word index
-    for (auto &[word, word_index_item] : word_index_) {
-        word_index_item.word = word;
-        word_index_item.word.shrink_to_fit();
-        word_index_item.occurrences.shrink_to_fit();
-        index_.words.emplace_back(::move(word_index_item));
+    // Build the random access word index. Flatten the words into the arena.
+    size_t char_count = 0, occurrence_count = 0;
+    for (const auto &[word, occurrences] : word_index_){
+        char_count += word.size();
+        occurrence_count += occurrences.size();
+    }
+    index_.word_chars.reserve(char_count);
+    index_.word_offsets.reserve(word_index_.size() + 1);
+    index_.word_occurrences.reserve(occurrence_count);
+    index_.word_occurrence_offsets.reserve(word_index_.size() + 1);
+    for (const auto &[word, occurrences] : word_index_) {
+        index_.word_offsets.emplace_back((Index)index_.word_chars.size());
+        index_.word_chars.insert(index_.word_chars.end(), word.cbegin(), word.cend());
+        index_.word_occurrence_offsets.emplace_back((Index)index_.word_occurrences.size());
+        index_.word_occurrences.insert(index_.word_occurrences.end(), occurrences.cbegin(), occurrences.cend());
+    }
+    index_.word_offsets.emplace_back((Index)index_.word_chars.size());
+    index_.word_occurrence_offsets.emplace_back((Index)index_.word_occurrences.size());
+    word_index_.clear();
+
+    return index_;
+}
+
+ItemIndex::IndexTables ItemIndex::mergeIndices(const vector<const Segment*> &parts) const
+{
+    static constexpr Index none = numeric_limits<Index>::max();
+    IndexTables merged;
+
+    // Remap the items and strings of all segments in order, dropping removed items
+    unordered_map<albert::Item*,Index> item_indices_;  // implicit unique
+    vector<vector<Index>> string_maps;
+    string_maps.reserve(parts.size());
+    for (const Segment *segment : parts) {
+        const auto &data = *segment->data;
+
+        vector<Index> item_map(data.items.size(), none);
+        for (Index i = 0; i < (Index)data.items.size(); ++i)
+            if (segment->removed.empty() || !segment->removed[i]) {
+                auto [it, emplaced] = item_indices_.emplace(data.items[i].get(), (Index)merged.items.size());
+                if (emplaced)
+                    merged.items.emplace_back(data.items[i]);
+                item_map[i] = it->second;
+            }
+
+        auto &string_map = string_maps.emplace_back(data.strings.size(), none);
+        for (Index s = 0; s < (Index)data.strings.size(); ++s)
+            if (auto item_index = item_map[data.strings[s].item]; item_index != none) {
+                string_map[s] = (Index)merged.strings.size();
+                merged.strings.emplace_back(item_index, data.strings[s].max_match_len);
+            }
+    }
+    merged.items.shrink_to_fit();
+    merged.strings.shrink_to_fit();
+
+    // K-way merge the sorted word tables. Equal words are popped in segment
+    // order, hence the remapped occurrences stay sorted by string index.
+    struct Cursor { size_t segment; Index word; };
+    auto greater = [&parts](const Cursor &l, const Cursor &r){
+        auto lw = parts[l.segment]->data->word(l.word);
+        auto rw = parts[r.segment]->data->word(r.word);
+        return lw == rw ? l.segment > r.segment : rw < lw;
+    };
+    priority_queue<Cursor, vector<Cursor>, decltype(greater)> queue(greater);
+    for (size_t p = 0; p < parts.size(); ++p)
+        if (parts[p]->data->wordCount() > 0)
+            queue.push({p, 0});
+
+    merged.word_offsets.emplace_back(0);
+    merged.word_occurrence_offsets.emplace_back(0);
+    while (!queue.empty()) {
+        auto cursor = queue.top();
+        queue.pop();
+        const auto &data = *parts[cursor.segment]->data;
+        const auto &string_map = string_maps[cursor.segment];
+        const auto word = data.word(cursor.word);
+
+        for (auto o = data.word_occurrence_offsets[cursor.word]; o < data.word_occurrence_offsets[cursor.word + 1]; ++o)
+            if (auto string_index = string_map[data.word_occurrences[o].index]; string_index != none)
+                merged.word_occurrences.emplace_back(string_index, data.word_occurrences[o].position);
+
+        // Close the word if no other segment has it. Drop words without occurrences.
+        if ((queue.empty() || parts[queue.top().segment]->data->word(queue.top().word) != word)
+            && merged.word_occurrences.size() > merged.word_occurrence_offsets.back()) {
+            merged.word_chars.insert(merged.word_chars.end(), word.cbegin(), word.cend());
+            merged.word_offsets.emplace_back((Index)merged.word_chars.size());
+            merged.word_occurrence_offsets.emplace_back((Index)merged.word_occurrences.size());
+        }
+
+        if (cursor.word + 1 < data.wordCount())
+            queue.push({cursor.segment, cursor.word + 1});
     }
-    index_.words.shrink_to_fit();
+    merged.word_chars.shrink_to_fit();
+    merged.word_offsets.shrink_to_fit();
+    merged.word_occurrences.shrink_to_fit();
+    merged.word_occurrence_offsets.shrink_to_fit();
 
+    buildNGramIndex(merged);
+    return merged;
+}
+
+void ItemIndex::buildNGramIndex(IndexTables &index_) const
+{
     if (error_tolerance_divisor){
+        auto word = [&index_](Index i){
+            return QStringView(index_.word_chars.data() + index_.word_offsets[i],
+                               index_.word_offsets[i+1] - index_.word_offsets[i]);
+        };
+
         // build q_gram_index
-        for (Index word_index = 0; word_index < (Index)index_.words.size(); ++word_index) {
-            vector<QString> ngrams(ngrams_for_word(index_.words[word_index].word, n));
-            for (Position pos = 0 ; pos < (Position)ngrams.size(); ++pos)
-                index_.ngrams[ngrams[pos]].emplace_back(word_index, pos);
+        struct NGramOccurrence { NGramKey key; Location location; };
+        auto less = [](const NGramOccurrence &l, const NGramOccurrence &r){ return l.key < r.key; };
+
+        // Collect and sort the n-grams of consecutive word ranges on the thread pool.
+        // Stable sorts and merges keep the occurrences in (w_idx, ng_pos) order.
+        struct Chunk { Index begin; Index end; vector<NGramOccurrence> ngram_occurrences; };
+        const auto word_count = index_.word_offsets.empty() ? 0 : (Index)index_.word_offsets.size() - 1;
+        const auto chunk_count = max<size_t>(1, min<size_t>(QThreadPool::globalInstance()->maxThreadCount(),
+                                                            word_count / MIN_WORDS_PER_CHUNK));
+        vector<Chunk> chunks;
+        for (size_t c = 0; c < chunk_count; ++c)
+            chunks.push_back({(Index)(c * word_count / chunk_count), (Index)((c + 1) * word_count / chunk_count), {}});
+
+        auto collect = [&](Chunk &chunk){
+            chunk.ngram_occurrences.reserve(index_.word_offsets[chunk.end] - index_.word_offsets[chunk.begin]);
+            for (Index word_index = chunk.begin; word_index < chunk.end; ++word_index) {
+                vector<NGramKey> ngrams(ngrams_for_word(word(word_index), n));
+                for (Position pos = 0 ; pos < (Position)ngrams.size(); ++pos)
+                    chunk.ngram_occurrences.push_back({ngrams[pos], Location(word_index, pos)});
+            }
+            stable_sort(chunk.ngram_occurrences.begin(), chunk.ngram_occurrences.end(), less);
+        };
+
+        if (chunks.size() == 1)
+            collect(chunks.front());
+        else
+            QtConcurrent::blockingMap(chunks, collect);
+
+        // Merge adjacent chunks pairwise until one is left
+        while (chunks.size() > 1) {
+            vector<Chunk> merged((chunks.size() + 1) / 2);
+            vector<size_t> pairs(merged.size());
+            iota(pairs.begin(), pairs.end(), 0);
+            QtConcurrent::blockingMap(pairs, [&](size_t p){
+                auto &l = chunks[2 * p];
+                if (2 * p + 1 == chunks.size()){
+                    merged[p] = ::move(l);
+                    return;
+                }
+                auto &r = chunks[2 * p + 1];
+                merged[p].begin = l.begin;
+                merged[p].end = r.end;
+                merged[p].ngram_occurrences.reserve(l.ngram_occurrences.size() + r.ngram_occurrences.size());
+                merge(l.ngram_occurrences.begin(), l.ngram_occurrences.end(),
+                      r.ngram_occurrences.begin(), r.ngram_occurrences.end(),
+                      back_inserter(merged[p].ngram_occurrences), less);
+                l = {};
+                r = {};
+            });
+            chunks = ::move(merged);
         }
+        const auto &ngram_occurrences = chunks.front().ngram_occurrences;
+
+        index_.ngram_occurrences.reserve(ngram_occurrences.size());
+        for (const auto &[key, location] : ngram_occurrences){
+            if (index_.ngram_keys.empty() || index_.ngram_keys.back() != key){
+                index_.ngram_keys.emplace_back(key);
+                index_.ngram_occurrence_offsets.emplace_back((Index)index_.ngram_occurrences.size());
+            }
+            index_.ngram_occurrences.emplace_back(location);
+        }
+        index_.ngram_occurrence_offsets.emplace_back((Index)index_.ngram_occurrences.size());
+        index_.ngram_keys.shrink_to_fit();
+        index_.ngram_occurrence_offsets.shrink_to_fit();
     }
-    for (auto &[_, word_refs] : index_.ngrams)
-        word_refs.shrink_to_fit();
+}
+
+void ItemIndex::setItems(std::vector<albert::IndexItem> &&index_items)
+{
+    // Writers build in call order, otherwise updates committed meanwhile or
+    // concurrent builds finishing earlier would be overwritten.
+    lock_guard build_lock(build_mutex);
+
+    auto snapshot_ = make_shared<Snapshot>();
+    if (auto data = buildIndex(::move(index_items)); !data.items.empty())
+        snapshot_->emplace_back(::move(data));
 
-    unique_lock lock(mutex);
-    index = index_;
+    lock_guard lock(write_mutex);
+    atomic_store(&snapshot, shared_ptr<const Snapshot>(::move(snapshot_)));
+    clearSearchCache();
 }
 
-std::vector<ItemIndex::WordMatch> ItemIndex::getWordMatches(const QString &word, const bool &isValid) const
+void ItemIndex::updateItems(const QStringList &removed_item_ids, std::vector<albert::IndexItem> &&added)
 {
-    vector<WordMatch> matches;
+    lock_guard build_lock(build_mutex);
+    IndexTables added_data = buildIndex(::move(added));
+
+    lock_guard lock(write_mutex);
+
+    // Copy on write. Cheap, the index data is shared.
+    auto snapshot_ = make_shared<Snapshot>(*atomic_load(&snapshot));
+    auto &segments = *snapshot_;
+
+    if (!removed_item_ids.isEmpty()){
+        for (auto &segment : segments) {
+            const auto &data = *segment.data;
+            const auto &item_ids = data.itemIds();
+            for (const auto &id : removed_item_ids) {
+                const auto &[begin, end] = item_ids.equal_range(id);
+                for (auto it = begin; it != end; ++it) {
+                    if (segment.removed.empty())
+                        segment.removed.resize(data.items.size(), false);
+                    if (!segment.removed[it->second]) {
+                        segment.removed[it->second] = true;
+                        ++segment.removed_count;
+                    }
+                }
+            }
+
+            // Rewrite segments consisting mostly of removed items
+            if (segment.removed_count * 2 > data.items.size())
+                segment = Segment(mergeIndices({&segment}));
+        }
+
+        erase_if(segments, [](const Segment &segment){ return segment.data->items.empty(); });
+    }
+
+    if (!added_data.items.empty())
+        segments.emplace_back(::move(added_data));
+
+    // Merge while the newest segment is not considerably smaller than its predecessor
+    while (segments.size() > 1
+           && segments[segments.size() - 2].data->strings.size() <= 2 * segments.back().data->strings.size()) {
+        Segment merged(mergeIndices({&segments[segments.size() - 2], &segments.back()}));
+        segments.pop_back();
+        segments.back() = ::move(merged);
+    }
+
+    atomic_store(&snapshot, shared_ptr<const Snapshot>(::move(snapshot_)));
+    clearSearchCache();
+}
+
+shared_ptr<Item> ItemIndex::item(const QString &id) const
+{
+    lock_guard lock(write_mutex);  // Guards the item ids
+    for (const auto &segment : *atomic_load(&snapshot)) {
+        const auto &data = *segment.data;
+        const auto &[begin, end] = data.itemIds().equal_range(id);
+        for (auto it = begin; it != end; ++it)
+            if ((segment.removed.empty() || !segment.removed[it->second])
+                && !dynamic_cast<const SnapshotItem*>(data.items[it->second].get()))
+                return data.items[it->second];
+    }
+    return {};
+}
+
+bool ItemIndex::saveSnapshot(const QString &path) const
+{
+    const auto snapshot_ = atomic_load(&snapshot);
+
+    // Write a single segment without removed items
+    IndexData merged;
+    const IndexData *data = &merged;
+    if (snapshot_->size() == 1 && snapshot_->front().removed_count == 0)
+        data = snapshot_->front().data.get();
+    else {
+        vector<const Segment*> segments;
+        for (const auto &segment : *snapshot_)
+            segments.emplace_back(&segment);
+        merged = IndexData(mergeIndices(segments));
+    }
+
+    QByteArray items;
+    QDataStream stream(&items, QIODevice::WriteOnly);
+    stream << separators << (quint32)data->items.size();
+    for (const auto &item : data->items)
+        stream << item->id() << item->text() << item->subtext() << item->inputActionText() << item->iconUrls();
+
+    const array<span<const byte>, 9> sections{
+        as_bytes(data->strings),
+        as_bytes(data->word_chars),
+        as_bytes(data->word_offsets),
+        as_bytes(data->word_occurrences),
+        as_bytes(data->word_occurrence_offsets),
+        as_bytes(data->ngram_keys),
+        as_bytes(data->ngram_occurrences),
+        as_bytes(data->ngram_occurrence_offsets),
+        as_bytes(span<const char>(items.constData(), (size_t)items.size()))
+    };
+
+    SnapshotHeader header{};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.n = n;
+    header.error_tolerance_divisor = error_tolerance_divisor;
+    header.case_sensitive = case_sensitive;
+    uint64_t offset = sizeof(SnapshotHeader);
+    for (size_t i = 0; i < sections.size(); ++i) {
+        offset = (offset + 7) & ~(uint64_t)7;
+        header.sections[i] = {offset, sections[i].size()};
+        offset += sections[i].size();
+    }
+
+    // Atomically replaces the file on commit, readers never see partial snapshots
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (size_t i = 0; i < sections.size(); ++i) {
+        static const char padding[8] = {};
+        file.write(padding, (qint64)(header.sections[i].offset - (uint64_t)file.pos()));
+        file.write(reinterpret_cast<const char*>(sections[i].data()), (qint64)sections[i].size());
+    }
+    return file.commit();
+}
+
+bool ItemIndex::loadSnapshot(const QString &path)
+{
+    static_assert(is_trivially_copyable_v<StringIndexItem> && is_trivially_copyable_v<Location>
+                  && is_trivially_copyable_v<QChar>);
+
+    auto file = make_shared<QFile>(path);
+    if (!file->open(QIODevice::ReadOnly) || file->size() < (qint64)sizeof(SnapshotHeader))
+        return false;
+    const auto size = (uint64_t)file->size();
+    const uchar *map = file->map(0, file->size());  // Lives as long as the file object
+    if (!map)
+        return false;
+
+    SnapshotHeader header;
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0
+        || header.version != SNAPSHOT_VERSION
+        || header.byte_order != SNAPSHOT_BYTE_ORDER
+        || header.n != n
+        || header.error_tolerance_divisor != error_tolerance_divisor
+        || header.case_sensitive != case_sensitive)
+        return false;
+
+    auto section = [&](size_t i, size_t alignment, size_t entry_size){
+        const auto &[offset, bytes] = header.sections[i];
+        return offset % alignment == 0 && bytes % entry_size == 0 && offset <= size && bytes <= size - offset;
+    };
+    IndexData data;
+    auto table = [&]<class T>(size_t i, span<const T> &t){
+        if (!section(i, alignof(T), sizeof(T)))
+            return false;
+        t = span<const T>(reinterpret_cast<const T*>(map + header.sections[i].offset),
+                          header.sections[i].size / sizeof(T));
+        return true;
+    };
+    if (!table(0, data.strings)
+        || !table(1, data.word_chars)
+        || !table(2, data.word_offsets)
+        || !table(3, data.word_occurrences)
+        || !table(4, data.word_occurrence_offsets)
+        || !table(5, data.ngram_keys)
+        || !table(6, data.ngram_occurrences)
+        || !table(7, data.ngram_occurrence_offsets)
+        || !section(8, 1, 1))
+        return false;
+
+    // Restore the items
+    auto items = QByteArray::fromRawData(reinterpret_cast<const char*>(map + header.sections[8].offset),
+                                         (qsizetype)header.sections[8].size);
+    QDataStream stream(items);
+    QString separators_;
+    quint32 item_count;
+    stream >> separators_ >> item_count;
+    if (stream.status() != QDataStream::Ok || separators_ != separators)
+        return false;
+    const weak_ptr<const ItemIndex> self = weak_from_this();
+    for (quint32 i = 0; i < item_count && stream.status() == QDataStream::Ok; ++i) {
+        QString id, text, subtext, input_action_text;
+        QStringList icon_urls;
+        stream >> id >> text >> subtext >> input_action_text >> icon_urls;
+        data.items.emplace_back(make_shared<SnapshotItem>(::move(id), ::move(text), ::move(subtext),
+                                                          ::move(input_action_text), ::move(icon_urls), self));
+    }
+    if (stream.status() != QDataStream::Ok)
+        return false;
+
+    // Searches trust the tables. Do not crash on corrupt files.
+    auto valid_offsets = [](span<const Index> offsets, size_t table_size){
+        return offsets.empty() ? table_size == 0
+                               : offsets.front() == 0 && offsets.back() == table_size
+                                 && is_sorted(offsets.begin(), offsets.end());
+    };
+    const auto word_count = data.wordCount();
+    if (!valid_offsets(data.word_offsets, data.word_chars.size())
+        || data.word_occurrence_offsets.size() != data.word_offsets.size()
+        || !valid_offsets(data.word_occurrence_offsets, data.word_occurrences.size())
+        || data.ngram_occurrence_offsets.size() != (error_tolerance_divisor ? data.ngram_keys.size() + 1 : 0)
+        || !valid_offsets(data.ngram_occurrence_offsets, data.ngram_occurrences.size())
+        || !ranges::all_of(data.strings, [&](const auto &s){ return s.item < data.items.size(); })
+        || !ranges::all_of(data.word_occurrences, [&](const auto &o){ return o.index < data.strings.size(); })
+        || !ranges::all_of(data.ngram_occurrences, [&](const auto &o){ return o.index < word_count; }))
+        return false;
+
+    data.storage = ::move(file);
+
+    lock_guard build_lock(build_mutex);
+    lock_guard lock(write_mutex);
+    if (!atomic_load(&snapshot)->empty())
+        return false;
+    auto snapshot_ = make_shared<Snapshot>();
+    if (!data.items.empty())
+        snapshot_->emplace_back(::move(data));
+    atomic_store(&snapshot, shared_ptr<const Snapshot>(::move(snapshot_)));
+    clearSearchCache();
+    return true;
+}
+
+size_t ItemIndex::memoryUsage() const
+{
+    size_t memory_usage = 0;
+    for (const auto &segment : *atomic_load(&snapshot))
+        memory_usage += segment.data->memoryUsage();
+    return memory_usage;
+}
+
+uint ItemIndex::allowedErrors(uint word_length) const
+{
+    return error_tolerance_divisor ? (uint)((float)word_length/(float)error_tolerance_divisor) : 0;
+}
+
+ItemIndex::WordMatches ItemIndex::getWordMatches(const IndexData &index, QStringView word,
+                                                 const bool &isValid) const
+{
+    WordMatches matches;
     const uint word_length = word.length();
 
     // Get range of perfect prefix match words
-    const auto &[eq_begin, eq_end] = equal_range(index.words.cbegin(), index.words.cend(), WordIndexItem{word, {}},
-                                                 [l=word_length](const WordIndexItem &a, const WordIndexItem &b) {
-                                                     return QStringView{a.word}.left(l) < QStringView{b.word}.left(l);
-                                                 });
+    auto word_indices = views::iota((Index)0, index.wordCount());
+    Index prefix_match_first_id = *ranges::partition_point(word_indices, [&](Index i){
+        return index.word(i).left(word_length) < word;
+    });  // Ignore interval. closed begin [
+    Index prefix_match_last_id = *ranges::partition_point(word_indices, [&](Index i){
+        return !(word < index.word(i).left(word_length));
+    });  // Ignore interval. open end )
 
     // Store perfect prefix match words
-    for (auto it = eq_begin; it != eq_end; ++it)
-        matches.emplace_back(*it, word_length);
+    for (Index w = prefix_match_first_id; w != prefix_match_last_id; ++w)
+        matches.emplace_back(w, word_length);
 
     // Get the (fuzzy) prefix matches
     if (error_tolerance_divisor) {
-        Index prefix_match_first_id = eq_begin - index.words.begin();  // Ignore interval. closed begin [
-        Index prefix_match_last_id = eq_end - index.words.begin();  // Ignore interval. open end )
 
         // Get the words referenced by each nGram and count the ngrams where position < word_length.
-        vector<QString> ngrams(ngrams_for_word(word, n));
+        vector<NGramKey> ngrams(ngrams_for_word(word, n));
         unordered_map<Index,uint> word_match_counts;
 
-        for (const QString &n_gram: ngrams) {
-            try {
-                for (const auto &ngram_occ: index.ngrams.at(n_gram)) {
-                    // Exclude the existing perfect matches
-                    if (prefix_match_first_id <= ngram_occ.index && ngram_occ.index < prefix_match_last_id)
-                        continue;
-
-                    if (ngram_occ.position < static_cast<Position>(word_length))
-                        ++word_match_counts[ngram_occ.index];
-//                    else
-//                        break;  // wtf is this
-                }
-            }
-            catch (const out_of_range &)
-            {
-                // NOTE room for optimizations?
+        for (const NGramKey &n_gram: ngrams) {
+            auto it = lower_bound(index.ngram_keys.begin(), index.ngram_keys.end(), n_gram);
+            if (it == index.ngram_keys.end() || *it != n_gram)
+                continue;
+
+            auto k = it - index.ngram_keys.begin();
+            for (auto o = index.ngram_occurrence_offsets[k]; o < index.ngram_occurrence_offsets[k+1]; ++o) {
+                const auto &ngram_occ = index.ngram_occurrences[o];
+
+                // Exclude the existing perfect matches
+                if (prefix_match_first_id <= ngram_occ.index && ngram_occ.index < prefix_match_last_id)
+                    continue;
+
+                if (ngram_occ.position < static_cast<Position>(word_length))
+                    ++word_match_counts[ngram_occ.index];
             }
         }
 
@@ -139,33 +692,63 @@ std::vector<ItemIndex::WordMatch> ItemIndex::getWordMatches(const QString &word,
         // Do (cheap) preselection by mathematical bound. If there are less than |word_length|-δ*n matching qGrams
         // it is no match. If the common qGrams are less than |word|-δ*q this implies that there are more errors
         // than δ.
-        uint allowed_errors = (uint)((float)word_length/(float)error_tolerance_divisor);
+        uint allowed_errors = allowedErrors(word_length);
         uint minimum_match_count = word_length - allowed_errors * n;
         Levenshtein levenshtein;
         for (const auto &[word_idx, ngram_count]: word_match_counts) {
             if (ngram_count < minimum_match_count || !isValid)
                 continue;
 
-            if (auto edit_distance = levenshtein.computePrefixEditDistanceWithLimit(word, index.words[word_idx].word,
+            if (auto edit_distance = levenshtein.computePrefixEditDistanceWithLimit(word, index.word(word_idx),
                                                                                     allowed_errors);
                     edit_distance > allowed_errors)
                 continue;
             else
-                matches.emplace_back(index.words[word_idx], word_length-edit_distance);
+                matches.emplace_back(word_idx, word_length-edit_distance);
         }
     }
     return matches;
 }
 
-std::vector<albert::RankItem> ItemIndex::search(const QString &string, const bool &isValid) const
+ItemIndex::WordMatches ItemIndex::refineWordMatches(const IndexData &index, const WordMatches &candidates,
+                                                    QStringView word, const bool &isValid) const
 {
-    QStringList &&words = splitString(string, separators, case_sensitive);
+    // The candidates are the matches of a prefix of word having the same
+    // error tolerance. Since the prefix edit distance does not decrease when
+    // the pattern grows, every match of word is among the candidates.
+    WordMatches matches;
+    const uint word_length = word.length();
+    const uint allowed_errors = allowedErrors(word_length);
+    Levenshtein levenshtein;
+    for (const auto &candidate : candidates) {
+        if (!isValid)
+            break;
+
+        if (const auto candidate_word = index.word(candidate.word); candidate_word.startsWith(word))
+            matches.emplace_back(candidate.word, word_length);
+        else if (error_tolerance_divisor)
+            if (auto edit_distance = levenshtein.computePrefixEditDistanceWithLimit(word, candidate_word,
+                                                                                    allowed_errors);
+                    edit_distance <= allowed_errors)
+                matches.emplace_back(candidate.word, word_length-edit_distance);
+    }
+    return matches;
+}
+
+unordered_map<ItemIndex::Index, float> ItemIndex::searchSegment(const Segment &segment,
+                                                                const vector<WordMatches> &word_matches,
+                                                                const bool &isValid) const
+{
+    const auto &index = *segment.data;
+    auto removed = [&segment](Index item){ return !segment.removed.empty() && segment.removed[item]; };
 
     unordered_map<Index, float> result_map;
-    if (words.empty())
+    if (word_matches.empty())
 
-        for (const auto &string_index_item : index.strings)
-            result_map.emplace(string_index_item.item, 0.0f);
+        for (const auto &string_index_item : index.strings) {
+            if (!removed(string_index_item.item))
+                result_map.emplace(string_index_item.item, 0.0f);
+        }
 
     else {
 
@@ -175,26 +758,28 @@ std::vector<albert::RankItem> ItemIndex::search(const QString &string, const boo
             Index index; Position position; uint16_t match_len;
         };
 
-        auto invert = [](const vector<WordMatch> &word_matches){
+        auto invert = [&index](const WordMatches &matches){
             vector<StringMatch> string_matches;
-            for (const auto &word_match : word_matches)
-                for (const auto &occurrence : word_match.word_index_item.occurrences)
-                    string_matches.emplace_back(occurrence.index, occurrence.position, word_match.match_length);
+            for (const auto &word_match : matches)
+                for (auto o = index.word_occurrence_offsets[word_match.word];
+                     o < index.word_occurrence_offsets[word_match.word + 1]; ++o)
+                    string_matches.emplace_back(index.word_occurrences[o].index,
+                                                index.word_occurrences[o].position,
+                                                word_match.match_length);
             sort(string_matches.begin(), string_matches.end(),
                  [](const auto &l, const auto &r){ return l.index < r.index; });
             return string_matches;
         };
 
-        shared_lock lock(mutex);
-        vector<StringMatch> left_matches = invert(getWordMatches(words[0], isValid));
+        vector<StringMatch> left_matches = invert(word_matches[0]);
 
         // In case of multiple words intersect. Todo: user chooses strategy
-        for (int w = 1; w < words.size(); ++w) {
+        for (size_t w = 1; w < word_matches.size(); ++w) {
 
             if (!isValid || left_matches.empty())
                 return {};
 
-            vector<StringMatch> right_matches = invert(getWordMatches(words[w], isValid));
+            vector<StringMatch> right_matches = invert(word_matches[w]);
 
             if (right_matches.empty())
                 return {};
@@ -233,6 +818,8 @@ std::vector<albert::RankItem> ItemIndex::search(const QString &string, const boo
 
         // Build the list of matched items with their highest scoring match
         for (const auto &match : left_matches) {
+            if (removed(index.strings[match.index].item))
+                continue;
             float score = (float)match.match_len / index.strings[match.index].max_match_len;
             if (const auto &[it, success] = result_map.emplace(index.strings[match.index].item, score);
                     !success && it->second < score) // update if exists
@@ -241,11 +828,128 @@ std::vector<albert::RankItem> ItemIndex::search(const QString &string, const boo
 
     }
 
+    return result_map;
+}
+
+std::vector<albert::RankItem> ItemIndex::search(const QString &string, const bool &isValid) const
+{
+    QString buffer;
+    vector<QStringView> words;
+    tokenizer.tokenize(string, buffer, words);
+
+    const auto snapshot_ = atomic_load(&snapshot);
+    const auto &segments = *snapshot_;
+
+    // Typing produces queries extending the previous one. Reuse the word
+    // matches of such a previous search and refine them. This avoids
+    // scanning the word and n-gram tables on every keystroke.
+    const auto previous = words.empty() ? nullptr : cachedSearch(snapshot_, words);
+    if (previous && previous->words.size() == words.size()
+        && ranges::equal(previous->words, words, [](const QString &l, QStringView r){ return l == r; })) {
+        ++search_cache_hits;
+        return previous->result;
+    }
+
+    auto current = make_shared<CachedSearch>();
+    current->snapshot = snapshot_;
+    for (const auto &word : words)
+        current->words.emplace_back(word.toString());
+    current->word_matches.resize(segments.size());
+
     // Convert results to return type
     vector<albert::RankItem> result;
-    result.reserve(result_map.size());
-    for (const auto &[item_idx, score] : result_map)
-        result.emplace_back(index.items[item_idx], score);
+    unordered_map<albert::Item*, size_t> result_indices;
+    for (size_t s = 0; s < segments.size(); ++s) {
+        const auto &segment = segments[s];
+        const auto &index = *segment.data;
+        auto &word_matches = current->word_matches[s];
+
+        for (size_t w = 0; w < words.size(); ++w) {
+            if (previous && w < previous->word_matches[s].size()) {
+                if (previous->words[w] == words[w])
+                    word_matches.emplace_back(previous->word_matches[s][w]);
+                else  // Extension of the last word of the previous search
+                    word_matches.emplace_back(refineWordMatches(index, previous->word_matches[s][w], words[w], isValid));
+            } else
+                word_matches.emplace_back(getWordMatches(index, words[w], isValid));
+
+            if (word_matches.back().empty())
+                break;
+        }
+
+        if (!word_matches.empty() && word_matches.back().empty())
+            continue;
+
+        if (segments.size() == 1) {
+            auto result_map = searchSegment(segment, word_matches, isValid);
+            result.reserve(result_map.size());
+            for (const auto &[item_idx, score] : result_map)
+                result.emplace_back(index.items[item_idx], score);
+        }
+        else
+            // Items may occur in several segments. Keep the highest scoring match.
+            for (const auto &[item_idx, score] : searchSegment(segment, word_matches, isValid)) {
+                const auto &item = index.items[item_idx];
+                if (const auto &[it, success] = result_indices.emplace(item.get(), result.size()); success)
+                    result.emplace_back(item, score);
+                else if (result[it->second].score < score)
+                    result[it->second].score = score;
+            }
+    }
+
+    // Do not cache incomplete results of cancelled searches
+    if (isValid && !words.empty()) {
+        current->result = result;
+        cacheSearch(::move(current));
+    }
+
+    return result;
+}
 
+shared_ptr<const ItemIndex::CachedSearch>
+ItemIndex::cachedSearch(const shared_ptr<const Snapshot> &snapshot_, const vector<QStringView> &words) const
+{
+    // Usable are searches of the same index generation whose words are equal
+    // to the leading words, except the last one, which has to be a prefix of
+    // the corresponding word having the same error tolerance.
+    auto usable = [&](const CachedSearch &cached){
+        const size_t last = cached.words.size() - 1;
+        return cached.snapshot.lock() == snapshot_
+               && cached.words.size() <= words.size()
+               && equal(cached.words.cbegin(), cached.words.cbegin() + last, words.cbegin(),
+                        [](const QString &l, QStringView r){ return l == r; })
+               && words[last].startsWith(cached.words[last])
+               && allowedErrors(words[last].size()) == allowedErrors(cached.words[last].size());
+    };
+
+    // Prefer an exact match, otherwise take the most recent usable search
+    shared_ptr<const CachedSearch> result;
+    lock_guard lock(search_cache_mutex);
+    for (const auto &cached : search_cache)
+        if (usable(*cached)) {
+            if (cached->words.size() == words.size() && cached->words.back() == words.back())
+                return cached;
+            if (!result)
+                result = cached;
+        }
     return result;
 }
+
+void ItemIndex::cacheSearch(shared_ptr<const CachedSearch> search) const
+{
+    lock_guard lock(search_cache_mutex);
+    erase_if(search_cache, [&](const auto &cached){
+        return cached->snapshot.expired() || cached->words == search->words;
+    });
+    search_cache.push_front(::move(search));
+    if (search_cache.size() > SEARCH_CACHE_SIZE)
+        search_cache.pop_back();
+}
+
+size_t ItemIndex::searchCacheHits() const { return search_cache_hits; }
+
+void ItemIndex::clearSearchCache()
+{
+    lock_guard lock(search_cache_mutex);
+    search_cache.clear();
+}
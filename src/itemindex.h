@@ -2,27 +2,54 @@
 
 #pragma once
 #include "index.h"
+#include "tokenizer.h"
 #include <QString>
-#include <shared_mutex>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <unordered_map>
+#include <vector>
 namespace albert {
 class Item;
 class RankItem;
 class IndexItem;
 }
 
-// Thread safe index class
-class ItemIndex : public Index
+// Thread safe index class. Searches never wait for writers.
+class ItemIndex : public Index, public std::enable_shared_from_this<ItemIndex>
 {
 public:
     explicit ItemIndex(QString separators, bool case_sensitive, uint n, uint error_tolerance_divisor);
 
     void setItems(std::vector<albert::IndexItem> &&) override;
+    void updateItems(const QStringList &removed_item_ids, std::vector<albert::IndexItem> &&added) override;
     std::vector<albert::RankItem> search(const QString &string, const bool &isValid) const override;
+    size_t memoryUsage() const override;
+
+    /// The number of searches answered by the search cache without matching.
+    size_t searchCacheHits() const;
+
+    /// Maps a snapshot file written by an index of the same configuration and
+    /// searches it in place until the first write. Items are restored without
+    /// actions; if the index is owned by a shared_ptr they get the actions of
+    /// the item having the same id after the index has been rebuilt.
+    /// Does nothing if the index is not empty. Returns true on success.
+    bool loadSnapshot(const QString &path);
+
+    /// Writes the current state of the index to a snapshot file. @threadsafe
+    /// Reads the properties of the items, i.e. the items have to be readable
+    /// from the calling thread.
+    bool saveSnapshot(const QString &path) const;
+
+    /// The item having id, if any. Not for items restored from a snapshot.
+    std::shared_ptr<albert::Item> item(const QString &id) const;
 
 private:
     using Index = uint32_t;
     using Position = uint16_t;
+    using NGramKey = uint64_t;  // n utf-16 code units packed, hence n <= 4
     struct Location {
         Location(Index i, Position p) : index(i), position(p) {}
         Index index;
@@ -37,32 +64,104 @@ private:
         //Score relevance;
     };
 
-    struct WordIndexItem {  // inverted string index, w_idx > (word, [(str_idx, w_pos)])
-        QString word;
-        std::vector<Location> occurrences;
+    // Flat, allocation-sparse layout. Tables in CSR format, i.e. the entries of
+    // row i are in the range [offsets[i], offsets[i+1]) of the data vector.
+    // Plain data only, hence the tables can be written to and mapped from files.
+    struct IndexTables {
+        std::vector<std::shared_ptr<albert::Item>> items;
+        std::vector<StringIndexItem> strings;
+
+        // Lexicographically sorted words, w_idx > (word, [(str_idx, w_pos)])
+        std::vector<QChar> word_chars;  // Contiguous arena of all words
+        std::vector<Index> word_offsets;  // CSR offsets into word_chars
+        std::vector<Location> word_occurrences;  // (str_idx, w_pos)
+        std::vector<Index> word_occurrence_offsets;  // CSR offsets into word_occurrences
+
+        // Sorted n-gram keys, ng_idx > (ngram, [(w_idx, ng_pos)])
+        std::vector<NGramKey> ngram_keys;
+        std::vector<Location> ngram_occurrences;  // (w_idx, ng_pos)
+        std::vector<Index> ngram_occurrence_offsets;  // CSR offsets into ngram_occurrences
     };
 
+    // Read-only view of the tables, either built in memory or mapped from a
+    // snapshot file. See IndexTables.
     struct IndexData {
+        IndexData() = default;
+        explicit IndexData(IndexTables &&);
+
         std::vector<std::shared_ptr<albert::Item>> items;
-        std::vector<StringIndexItem> strings;
-        std::vector<WordIndexItem> words;
-        std::unordered_map<QString, std::vector<Location>> ngrams;
+        std::span<const StringIndexItem> strings;
+        std::span<const QChar> word_chars;
+        std::span<const Index> word_offsets;
+        std::span<const Location> word_occurrences;
+        std::span<const Index> word_occurrence_offsets;
+        std::span<const NGramKey> ngram_keys;
+        std::span<const Location> ngram_occurrences;
+        std::span<const Index> ngram_occurrence_offsets;
+        std::shared_ptr<const void> storage;  // Owns the tables, IndexTables or the mapped file
+
+        // Item id > item index. Lazily built by writers, never touched by searches.
+        mutable std::unordered_multimap<QString, Index> item_ids;
+
+        Index wordCount() const;
+        QStringView word(Index i) const;
+        const std::unordered_multimap<QString, Index> &itemIds() const;  // Writers only
+        size_t memoryUsage() const;
     };
 
+    // Index data is never modified. Updates are added as new segments and
+    // removals are marked. Segments are merged log-structured, i.e. whenever
+    // the newest segment gets about as large as its predecessor. This way
+    // every string gets merged O(log n) times.
+    struct Segment {
+        explicit Segment(IndexData &&d) : data(std::make_shared<const IndexData>(std::move(d))) {}
+        explicit Segment(IndexTables &&t) : Segment(IndexData(std::move(t))) {}
+        std::shared_ptr<const IndexData> data;  // Shared by the snapshots
+        std::vector<bool> removed;  // Per item, empty if nothing was removed
+        Index removed_count = 0;
+    };
+
+    // Immutable state of the index. Writers build a new snapshot and publish
+    // it atomically (RCU-like). Searches keep the snapshot they started with.
+    using Snapshot = std::vector<Segment>;
+
     struct WordMatch {
-        WordMatch(const WordIndexItem &wii, uint ml)
-            : word_index_item(wii), match_length(ml){}
-        const WordIndexItem &word_index_item;
+        WordMatch(Index w, uint ml)
+            : word(w), match_length(ml){}
+        Index word;
         uint16_t match_length;
     };
 
-    mutable std::shared_mutex mutex;
-    IndexData index;
+    using WordMatches = std::vector<WordMatch>;
+
+    // A recent search. Searches extending it (same index generation) reuse
+    // its word matches. Defined in the translation unit.
+    struct CachedSearch;
+
+    std::shared_ptr<const Snapshot> snapshot;  // Access using std::atomic_load/store only
+    std::mutex build_mutex;  // Serializes writers, held while building
+    mutable std::mutex write_mutex;  // Guards publishing and the item ids
+    mutable std::deque<std::shared_ptr<const CachedSearch>> search_cache;  // Most recent first
+    mutable std::mutex search_cache_mutex;
+    mutable std::atomic<size_t> search_cache_hits = 0;
+    const QString separators;
     const bool case_sensitive;
+    const Tokenizer tokenizer;
     const uint error_tolerance_divisor;
-    const QString separators;
     const uint n;
 
-//    IndexData buildIndex(std::vector<albert::IndexItem> &&index_items) const;
-    std::vector<WordMatch> getWordMatches(const QString &word, const bool &isValid) const;
+    IndexTables buildIndex(std::vector<albert::IndexItem> &&index_items) const;
+    IndexTables buildWordIndex(std::vector<albert::IndexItem> &&index_items) const;
+    IndexTables mergeIndices(const std::vector<const Segment*> &segments) const;
+    void buildNGramIndex(IndexTables &) const;
+    std::unordered_map<Index, float> searchSegment(const Segment &, const std::vector<WordMatches> &word_matches,
+                                                   const bool &isValid) const;
+    WordMatches getWordMatches(const IndexData &, QStringView word, const bool &isValid) const;
+    WordMatches refineWordMatches(const IndexData &, const WordMatches &candidates, QStringView word,
+                                  const bool &isValid) const;
+    uint allowedErrors(uint word_length) const;
+    std::shared_ptr<const CachedSearch> cachedSearch(const std::shared_ptr<const Snapshot> &,
+                                                     const std::vector<QStringView> &words) const;
+    void cacheSearch(std::shared_ptr<const CachedSearch>) const;
+    void clearSearchCache();
 };
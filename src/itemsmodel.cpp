@@ -8,45 +8,125 @@
 #include "usagedatabase.h"
 #include "query.h"
 #include "qmlrolenames.h"
+#include <QCoreApplication>
+#include <QPointer>
 #include <QStringListModel>
+#include <QThreadPool>
 #include <QTimer>
+#include <algorithm>
 using namespace albert;
 using namespace std;
+static const size_t INITIAL_PAGE_SIZE = 25;
 
 
-ItemsModel::ItemsModel(QObject *parent) : QAbstractListModel(parent) {}
+ItemsModel::ItemsModel(QObject *parent) : QAbstractListModel(parent), fetch_count(INITIAL_PAGE_SIZE)
+{
+    materialize_timer.setSingleShot(true);
+    materialize_timer.setInterval(0);
+    connect(&materialize_timer, &QTimer::timeout, this, &ItemsModel::materializeRequested);
+}
 
-int ItemsModel::rowCount(const QModelIndex &) const { return (int)items.size(); }
+int ItemsModel::rowCount(const QModelIndex &) const
+{ return (int)(virtualized ? items.size() + pending.size() + appended.size() : items.size()); }
 
 QVariant ItemsModel::data(const QModelIndex &index, int role) const
 {
     if (index.isValid()) {
-        const auto &[extension, item] = items[index.row()];
+        const auto resolved_row = resolved((size_t)index.row());
+        if (!resolved_row) {  // Getters must not modify the model
+            requested_rows.push_back((size_t)index.row());
+            materialize_timer.start();
+            return {};
+        }
 
+        const auto row = *resolved_row;
         switch (role) {
-            case (int)ItemRoles::TextRole:{
-                QString text = item->text();
-                text.replace('\n', ' ');
-                return text;
+            case (int)ItemRoles::TextRole: return roles(row).text;
+            case (int)ItemRoles::SubTextRole: return roles(row).subtext;
+            case Qt::ToolTipRole: {
+                const auto &item = items[row].item;
+                return QString("%1\n%2").arg(item->text(), item->subtext());
             }
-            case (int)ItemRoles::SubTextRole:{
-                QString text = item->subtext();
-                text.replace('\n', ' ');
-                return text;
-            }
-            case Qt::ToolTipRole: return QString("%1\n%2").arg(item->text(), item->subtext());
-            case (int)ItemRoles::InputActionRole: return item->inputActionText();
-            case (int)ItemRoles::IconUrlsRole: return item->iconUrls();
+            case (int)ItemRoles::InputActionRole: return roles(row).input_action_text;
+            case (int)ItemRoles::IconUrlsRole: return roles(row).icon_urls;
         }
     }
     return {};
 }
 
+unique_ptr<ItemsModel::Roles> ItemsModel::makeRoles(const Item &item)
+{
+    auto roles = make_unique<Roles>();
+    roles->text = item.text();
+    roles->text.replace('\n', ' ');
+    roles->subtext = item.subtext();
+    roles->subtext.replace('\n', ' ');
+    roles->input_action_text = item.inputActionText();
+    roles->icon_urls = item.iconUrls();
+    return roles;
+}
+
+const ItemsModel::Roles &ItemsModel::roles(size_t row) const
+{
+    const auto &r = items[row];
+    if (!r.roles) {
+        r.roles = makeRoles(*r.item);
+        if (prefetch_window)
+            prefetch(row + 1);
+    }
+    return *r.roles;
+}
+
+void ItemsModel::prefetch(size_t row) const
+{
+    if (prefetch_running)
+        return;
+
+    vector<pair<size_t, shared_ptr<Item>>> window;
+    for (auto end = min(items.size(), row + prefetch_window); row < end; ++row)
+        if (!items[row].roles)
+            window.emplace_back(row, items[row].item);
+    if (window.empty())
+        return;
+
+    // Compute on a worker, store on the thread of the model. Rows may have
+    // moved meanwhile, results of rows not holding the item anymore are dropped.
+    prefetch_running = true;
+    QThreadPool::globalInstance()->start([model = QPointer<const ItemsModel>(this), window = ::move(window)]{
+        auto roles = make_shared<vector<unique_ptr<Roles>>>();
+        for (const auto &[row, item] : window)
+            roles->emplace_back(makeRoles(*item));
+
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [model, window, roles]{
+            if (!model)
+                return;
+            model->prefetch_running = false;
+            for (size_t i = 0; i < window.size(); ++i)
+                if (const auto &[row, item] = window[i]; row < model->items.size()
+                    && model->items[row].item == item && !model->items[row].roles)
+                    model->items[row].roles = ::move((*roles)[i]);
+        });
+    });
+}
+
+void ItemsModel::invalidate(const Item *item)
+{
+    for (size_t row = 0; row < items.size(); ++row)
+        if (!item || items[row].item.get() == item) {
+            items[row].roles.reset();
+            const auto view_row = (int)viewRow(row);
+            emit dataChanged(index(view_row), index(view_row));
+        }
+}
+
+void ItemsModel::setPrefetchWindow(uint rows) { prefetch_window = rows; }
+
 QHash<int, QByteArray> ItemsModel::roleNames() const { return albert::QmlRoleNames; }
 
 void ItemsModel::add(Extension *extension, shared_ptr<Item> &&item)
 {
-    beginInsertRows(QModelIndex(), (int)items.size(), (int)items.size());
+    const auto row = (int)viewRow(items.size());
+    beginInsertRows(QModelIndex(), row, row);
     items.emplace_back(extension, ::move(item));
     endInsertRows();
 }
@@ -56,7 +136,8 @@ void ItemsModel::add(Extension *extension, vector<shared_ptr<Item>> &&itemvec)
     if (itemvec.empty())
         return;
 
-    beginInsertRows(QModelIndex(), (int)items.size(), (int)(items.size()+itemvec.size()-1));
+    const auto row = (int)viewRow(items.size());
+    beginInsertRows(QModelIndex(), row, row+(int)itemvec.size()-1);
     items.reserve(items.size()+itemvec.size());
     for (auto &&item : itemvec)
         items.emplace_back(extension, ::move(item));
@@ -65,7 +146,8 @@ void ItemsModel::add(Extension *extension, vector<shared_ptr<Item>> &&itemvec)
 
 void ItemsModel::add(Extension *extension, const shared_ptr<Item> &item)
 {
-    beginInsertRows(QModelIndex(), (int)items.size(), (int)items.size());
+    const auto row = (int)viewRow(items.size());
+    beginInsertRows(QModelIndex(), row, row);
     items.emplace_back(extension, item);
     endInsertRows();
 }
@@ -75,7 +157,8 @@ void ItemsModel::add(Extension *extension, const vector<shared_ptr<Item>> &itemv
     if (itemvec.empty())
         return;
 
-    beginInsertRows(QModelIndex(), (int)items.size(), (int)(items.size()+itemvec.size()-1));
+    const auto row = (int)viewRow(items.size());
+    beginInsertRows(QModelIndex(), row, row+(int)itemvec.size()-1);
     items.reserve(items.size()+itemvec.size());
     for (auto &item : itemvec)
         items.emplace_back(extension, item);
@@ -88,32 +171,256 @@ void ItemsModel::add(vector<pair<Extension*,RankItem>>::iterator begin,
     if (begin == end)
         return;
 
-    beginInsertRows(QModelIndex(), (int)items.size(), (int)(items.size())+(int)(end-begin)-1);
+    const auto row = (int)viewRow(items.size());
+    beginInsertRows(QModelIndex(), row, row+(int)(end-begin)-1);
     items.reserve(items.size()+(size_t)(end-begin));
     for (auto it = begin; it != end; ++it)
         items.emplace_back(it->first, ::move(it->second.item));
     endInsertRows();
 }
 
+pair<Extension*,RankItem> &ItemsModel::resolve(ItemRef ref) { return batches[ref.batch].rank_items[ref.index]; }
+
+const pair<Extension*,RankItem> &ItemsModel::resolve(ItemRef ref) const { return batches[ref.batch].rank_items[ref.index]; }
+
+const QString &ItemsModel::sortText(ItemRef ref) const { return batches[ref.batch].sort_texts[ref.index]; }
+
+vector<ItemsModel::ItemRef> ItemsModel::enqueue(vector<pair<Extension*,RankItem>> &&rank_items,
+                                                vector<QString> &&sort_texts)
+{
+    Q_ASSERT(rank_items.size() == sort_texts.size());
+    vector<ItemRef> refs;
+    refs.reserve(rank_items.size());
+    for (uint32_t i = 0; i < (uint32_t)rank_items.size(); ++i)
+        refs.push_back({(uint32_t)batches.size(), i});
+    batches.push_back({::move(rank_items), ::move(sort_texts)});
+    return refs;
+}
+
+bool ItemsModel::ranksHigher(ItemRef a, ItemRef b) const
+{
+    const auto score_a = resolve(a).second.score;
+    const auto score_b = resolve(b).second.score;
+    if (score_a == score_b)
+        return sortText(a) > sortText(b);
+    else
+        return score_a > score_b;
+}
+
+void ItemsModel::add(vector<pair<Extension*,RankItem>> &&rank_items, vector<QString> &&sort_texts)
+{
+    if (rank_items.empty())
+        return;
+
+    auto batch = enqueue(::move(rank_items), ::move(sort_texts));
+    const auto higher = [this](ItemRef a, ItemRef b){ return ranksHigher(a, b); };
+
+    if (scores.empty() && pending.empty()) {  // Nothing to merge with
+        if (virtualized) {
+            beginInsertRows(QModelIndex(), 0, (int)batch.size()-1);
+            pending = ::move(batch);
+            insertTop(pending, 0, true, INITIAL_PAGE_SIZE, false);  // Keeps the invariant below
+            endInsertRows();
+        } else {
+            pending = ::move(batch);
+            insertTop(pending, 0, true, fetch_count);
+        }
+        return;
+    }
+
+    // The ranked rows stay at least a page. Invariant: pending items do not rank higher than the last ranked row.
+    const size_t target = max(scores.size(), INITIAL_PAGE_SIZE);
+    const auto middle = batch.begin() + (ptrdiff_t)min(target, batch.size());
+    partial_sort(batch.begin(), middle, batch.end(), higher);
+
+    // Merge the top of the batch into the ranked rows, after rows of equal rank
+    auto it = batch.begin();
+    for (size_t row = 0; it != middle; ++it, ++row) {
+        auto &[extension, rank_item] = resolve(*it);
+        const auto &text = sortText(*it);
+        for (; row < scores.size(); ++row)
+            if (rank_item.score > scores[row]
+                || (rank_item.score == scores[row] && text > sortText(items[row].origin)))
+                break;
+
+        if (row >= target)
+            break;
+
+        beginInsertRows(QModelIndex(), (int)row, (int)row);
+        items.emplace(items.begin() + (ptrdiff_t)row, extension, ::move(rank_item.item), *it);
+        scores.emplace(scores.begin() + (ptrdiff_t)row, rank_item.score);
+        endInsertRows();
+    }
+
+    // Ranked rows pushed out of the page go back to pending
+    if (const auto end = scores.size(); end > target) {
+        if (!virtualized)
+            beginRemoveRows(QModelIndex(), (int)target, (int)end-1);
+        for (auto row = target; row < end; ++row) {
+            resolve(items[row].origin).second.item = ::move(items[row].item);
+            pending.push_back(items[row].origin);
+        }
+        items.erase(items.begin() + (ptrdiff_t)target, items.begin() + (ptrdiff_t)end);
+        scores.resize(target);
+        if (!virtualized)
+            endRemoveRows();
+        else  // The rows stay, but get resolved anew
+            emit dataChanged(index((int)target), index((int)end-1));
+    }
+
+    if (virtualized && it != batch.end()) {
+        const auto row = (int)(scores.size() + pending.size());
+        beginInsertRows(QModelIndex(), row, row + (int)(batch.end()-it) - 1);
+        pending.insert(pending.end(), it, batch.end());
+        endInsertRows();
+    } else
+        pending.insert(pending.end(), it, batch.end());
+}
+
+void ItemsModel::append(vector<pair<Extension*,RankItem>> &&rank_items, vector<QString> &&sort_texts)
+{
+    if (rank_items.empty())
+        return;
+
+    auto batch = enqueue(::move(rank_items), ::move(sort_texts));
+
+    if (virtualized) {
+        const auto row = rowCount(QModelIndex());
+        beginInsertRows(QModelIndex(), row, row + (int)batch.size() - 1);
+        appended.insert(appended.end(), batch.begin(), batch.end());
+        endInsertRows();
+    } else {
+        appended.insert(appended.end(), batch.begin(), batch.end());
+        if (pending.empty())
+            insertTop(appended, items.size(), false, fetch_count);
+    }
+}
+
+bool ItemsModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !virtualized && !parent.isValid() && (!pending.empty() || !appended.empty());
+}
+
+void ItemsModel::fetchMore(const QModelIndex &parent)
+{
+    if (virtualized || parent.isValid())
+        return;
+
+    if (!pending.empty())
+        insertTop(pending, scores.size(), true, fetch_count);
+    else if (!appended.empty())
+        insertTop(appended, items.size(), false, fetch_count);
+
+    // Pages grow geometrically to keep the number of fetches logarithmic
+    // when scrolling through all items.
+    fetch_count *= 2;
+}
+
+void ItemsModel::insertTop(vector<ItemRef> &from, size_t row, bool ranked, size_t count, bool notify)
+{
+    // Sort the requested rows only
+    count = min(count, from.size());
+    const auto middle = from.begin() + (ptrdiff_t)count;
+    partial_sort(from.begin(), middle, from.end(), [this](ItemRef a, ItemRef b){ return ranksHigher(a, b); });
+
+    vector<Row> page;
+    page.reserve(count);
+    for (auto it = from.begin(); it != middle; ++it) {
+        auto &[extension, rank_item] = resolve(*it);
+        page.emplace_back(extension, ::move(rank_item.item), *it);
+        if (ranked)
+            scores.emplace_back(rank_item.score);
+    }
+
+    if (notify)
+        beginInsertRows(QModelIndex(), (int)row, (int)(row+count-1));
+    items.insert(items.begin() + (ptrdiff_t)row, make_move_iterator(page.begin()), make_move_iterator(page.end()));
+    if (notify)
+        endInsertRows();
+
+    from.erase(from.begin(), middle);
+    if (from.empty())
+        from.shrink_to_fit();
+}
+
+// Virtual row layout: ranked rows, pending rows, appended rows, unresolved
+// appended rows. Rows are resolved in order, i.e. resolving a pending row
+// resolves all pending rows ranking higher first.
+size_t ItemsModel::materialize(size_t row)
+{
+    if (!virtualized || row < scores.size())
+        return row;
+
+    const auto ranked = scores.size();
+    if (row < ranked + pending.size()) {
+        insertTop(pending, ranked, true, max(row - ranked + 1, INITIAL_PAGE_SIZE), false);
+        return row;
+    }
+
+    const auto i = row - pending.size();
+    if (i >= items.size())
+        insertTop(appended, items.size(), false, max(i - items.size() + 1, INITIAL_PAGE_SIZE), false);
+    return i;
+}
+
+optional<size_t> ItemsModel::resolved(size_t row) const
+{
+    if (!virtualized || row < scores.size())
+        return row;
+    if (row < scores.size() + pending.size())
+        return {};
+    if (const auto i = row - pending.size(); i < items.size())
+        return i;
+    return {};
+}
+
+void ItemsModel::materializeRequested()
+{
+    if (requested_rows.empty())
+        return;
+
+    // Resolving does not move view rows, but may resolve rows in between
+    const auto [first, last] = minmax_element(requested_rows.begin(), requested_rows.end());
+    const auto first_row = (int)*first, last_row = (int)*last;
+    const auto row_count = rowCount(QModelIndex());
+    for (auto row : exchange(requested_rows, {}))
+        if (row < (size_t)row_count)
+            materialize(row);
+    if (first_row < row_count)
+        emit dataChanged(index(first_row), index(min(last_row, row_count-1)));
+}
+
+size_t ItemsModel::viewRow(size_t i) const
+{ return virtualized && i >= scores.size() ? i + pending.size() : i; }
+
+void ItemsModel::setVirtualized(bool value) { virtualized = value; }
+
 QAbstractListModel *ItemsModel::buildActionsModel(uint i) const
 {
     QStringList l;
-    for (const auto &a : items[i].second->actions())
-        l << a.text;
+    if (const auto row = resolved(i); row && *row < items.size())  // Unresolved rows were never shown
+        for (const auto &a : items[*row].item->actions())
+            l << a.text;
     return new QStringListModel(l);
 }
 
 void ItemsModel::activate(QueryBase *q, uint i, uint a)
 {
-    if (i<items.size()){
-        auto &[extension, item] = items[i];
+    if ((int)i<rowCount(QModelIndex())){
+        i = (uint)materialize(i);
+        const auto extension = items[i].extension;
+        const auto item = items[i].item;  // Keep alive, the action may alter the model
         auto actions = item->actions();
         if (a<actions.size()){
             // sane context arg. it is intended to be executed later out of context.
             // QTimer::singleShot… dont. query has to stay alive as indicator for pluginregistry
             UsageHistory::addActivation(q->string(), extension->id(), item->id(), actions[a].id);
+            QPointer<ItemsModel> model(this);
             actions[a].function(); // afterwards because query is dea
 
+            // Actions may change the item, e.g. its state in the subtext
+            if (model)
+                invalidate(item.get());
         }
         else
             WARN << "Activated action index is invalid.";
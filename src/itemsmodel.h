@@ -2,15 +2,18 @@
 
 #pragma once
 #include "albert/extension.h"
+#include "albert/extension/queryhandler/rankitem.h"
 #include <QAbstractListModel>
 #include <QIcon>
+#include <QString>
+#include <QTimer>
 #include <map>
 #include <memory>
+#include <optional>
 #include <vector>
 class QueryBase;
 namespace albert{
 class Item;
-class RankItem;
 }
 
 class ItemsModel : public QAbstractListModel
@@ -21,6 +24,8 @@ public:
     QHash<int, QByteArray> roleNames() const override;
     int rowCount(const QModelIndex &parent) const override;
     QVariant data(const QModelIndex &index, int role) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
 
     void add(albert::Extension*, const std::shared_ptr<albert::Item>&);
     void add(albert::Extension*, std::shared_ptr<albert::Item>&&);
@@ -31,9 +36,87 @@ public:
     void add(std::vector<std::pair<albert::Extension*,albert::RankItem>>::iterator begin,
              std::vector<std::pair<albert::Extension*,albert::RankItem>>::iterator end);
 
+    /// Merges ranked items into the ranked rows in order of descending score,
+    /// ties ordered by sort_texts, the texts of the items. Stable, i.e. the
+    /// order of existing rows is kept. Only the first page is sorted and
+    /// inserted, the rest on fetchMore.
+    void add(std::vector<std::pair<albert::Extension*,albert::RankItem>> &&rank_items,
+             std::vector<QString> &&sort_texts);
+
+    /// Appends ranked items after all items added using add(…), including
+    /// the ones not fetched yet.
+    void append(std::vector<std::pair<albert::Extension*,albert::RankItem>> &&rank_items,
+                std::vector<QString> &&sort_texts);
+
     QAbstractListModel *buildActionsModel(uint i) const;
     void activate(QueryBase *q, uint i, uint a);
 
+    /// Drops the cached role values of the rows of item, all if nullptr.
+    void invalidate(const albert::Item *item = nullptr);
+
+    /// The number of rows following a requested row whose role values are
+    /// computed on a worker thread ahead of time. Zero disables prefetching.
+    void setPrefetchWindow(uint rows);
+
+    /// Exposes all rows at once instead of fetching them in pages. Rows are
+    /// kept as references into the added rank items and resolved in the
+    /// event loop after their data got requested. Set before adding items.
+    void setVirtualized(bool);
+
 private:
-    std::vector<std::pair<albert::Extension*, std::shared_ptr<albert::Item>>> items;
+    struct Roles {
+        QString text;  // Newlines replaced
+        QString subtext;  // Newlines replaced
+        QString input_action_text;
+        QStringList icon_urls;
+    };
+    static std::unique_ptr<Roles> makeRoles(const albert::Item &);
+    const Roles &roles(size_t row) const;
+    void prefetch(size_t row) const;
+
+    // Compact reference to a rank item of a batch passed to add(…) or append(…)
+    struct ItemRef {
+        uint32_t batch;
+        uint32_t index;
+    };
+    // Every row needs its key, also unresolved virtualized ones, since sorting
+    // the requested rows compares them to all remaining rows. A key is a
+    // QString, i.e. 24 bytes per row and usually shares the data of the item.
+    struct Batch {
+        std::vector<std::pair<albert::Extension*,albert::RankItem>> rank_items;
+        std::vector<QString> sort_texts;  // Tie-break keys, computed by the caller
+    };
+
+    struct Row {
+        Row(albert::Extension *e, std::shared_ptr<albert::Item> i, ItemRef o = {})
+            : extension(e), item(std::move(i)), origin(o) {}
+        albert::Extension *extension;
+        std::shared_ptr<albert::Item> item;
+        mutable std::unique_ptr<Roles> roles;  // Lazily cached role values
+        ItemRef origin;  // Of ranked rows, where the item goes when pushed out
+    };
+
+    std::pair<albert::Extension*,albert::RankItem> &resolve(ItemRef);
+    const std::pair<albert::Extension*,albert::RankItem> &resolve(ItemRef) const;
+    const QString &sortText(ItemRef) const;
+    std::vector<ItemRef> enqueue(std::vector<std::pair<albert::Extension*,albert::RankItem>> &&,
+                                 std::vector<QString> &&sort_texts);
+    bool ranksHigher(ItemRef, ItemRef) const;
+    void insertTop(std::vector<ItemRef> &from, size_t row, bool ranked, size_t count, bool notify = true);
+    size_t materialize(size_t row);  // View row > index into items
+    std::optional<size_t> resolved(size_t row) const;  // View row > index into items, if resolved
+    void materializeRequested();
+    size_t viewRow(size_t i) const;  // Index into items > view row
+
+    std::vector<Row> items;
+    std::vector<float> scores;  // Of the ranked rows, i.e. the first scores.size() items
+    std::vector<Batch> batches;  // Hold the items of pending and appended
+    std::vector<ItemRef> pending;  // Ranked items not yet inserted, unsorted
+    std::vector<ItemRef> appended;  // Appended items not yet inserted, unsorted
+    size_t fetch_count;
+    bool virtualized = false;
+    uint prefetch_window = 0;
+    mutable bool prefetch_running = false;
+    mutable std::vector<size_t> requested_rows;  // Unresolved view rows whose data got requested
+    mutable QTimer materialize_timer;  // Resolves the requested rows in the event loop
 };
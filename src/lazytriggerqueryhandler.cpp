@@ -0,0 +1,55 @@
+// Copyright (c) 2023 Manuel Schneider
+
+#include "lazytriggerqueryhandler.h"
+#include <QObject>
+#include <chrono>
+using namespace albert;
+using namespace std;
+
+LazyTriggerQueryHandler::LazyTriggerQueryHandler(Properties p, QObject *context, function<void()> activate)
+    : properties(::move(p)), context_(context), activate_(::move(activate)) {}
+
+QString LazyTriggerQueryHandler::id() const { return properties.id; }
+
+QString LazyTriggerQueryHandler::name() const { return properties.name; }
+
+QString LazyTriggerQueryHandler::description() const { return properties.description; }
+
+QString LazyTriggerQueryHandler::synopsis() const { return properties.synopsis; }
+
+QString LazyTriggerQueryHandler::defaultTrigger() const { return properties.default_trigger; }
+
+bool LazyTriggerQueryHandler::allowTriggerRemap() const { return properties.allow_trigger_remap; }
+
+bool LazyTriggerQueryHandler::supportsFuzzyMatching() const { return properties.supports_fuzzy_matching; }
+
+void LazyTriggerQueryHandler::handleTriggerQuery(TriggerQuery *query) const
+{
+    unique_lock lock(mutex_);
+
+    if (!activation_requested_) {
+        activation_requested_ = true;
+        QMetaObject::invokeMethod(context_, activate_, Qt::QueuedConnection);
+    }
+
+    // Do not block: the GUI thread waits for cancelled queries, e.g. while
+    // the plugin gets loaded.
+    while (!is_activated_ && query->isValid())
+        activated_.wait_for(lock, chrono::milliseconds(10));
+
+    auto *handler = handler_;
+    lock.unlock();
+
+    if (handler && query->isValid())
+        handler->handleTriggerQuery(query);
+}
+
+void LazyTriggerQueryHandler::setHandler(TriggerQueryHandler *handler)
+{
+    {
+        lock_guard lock(mutex_);
+        handler_ = handler;
+        is_activated_ = true;
+    }
+    activated_.notify_all();
+}
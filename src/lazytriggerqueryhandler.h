@@ -0,0 +1,52 @@
+// Copyright (c) 2023 Manuel Schneider
+
+#pragma once
+#include "albert/extension/queryhandler/triggerqueryhandler.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+class QObject;
+
+// Stands in for a trigger query handler of a plugin that is not loaded yet.
+// Built from the properties the handler had when the plugin was loaded the
+// last time. The first query requests the activation of the plugin and is
+// forwarded to the real handler once it is loaded.
+class LazyTriggerQueryHandler : public albert::TriggerQueryHandler
+{
+public:
+    struct Properties {
+        QString id;
+        QString name;
+        QString description;
+        QString synopsis;
+        QString default_trigger;
+        bool allow_trigger_remap;
+        bool supports_fuzzy_matching;
+    };
+
+    // activate is invoked in the thread of context and has to call setHandler
+    LazyTriggerQueryHandler(Properties properties, QObject *context, std::function<void()> activate);
+
+    QString id() const override;
+    QString name() const override;
+    QString description() const override;
+    QString synopsis() const override;
+    QString defaultTrigger() const override;
+    bool allowTriggerRemap() const override;
+    bool supportsFuzzyMatching() const override;
+    void handleTriggerQuery(TriggerQuery*) const override;
+
+    // The real handler, nullptr if loading the plugin failed. Releases waiting queries.
+    void setHandler(albert::TriggerQueryHandler *handler);
+
+    const Properties properties;
+
+private:
+    QObject * const context_;
+    const std::function<void()> activate_;
+    mutable std::mutex mutex_;
+    mutable std::condition_variable activated_;
+    mutable bool activation_requested_ = false;
+    bool is_activated_ = false;
+    albert::TriggerQueryHandler *handler_ = nullptr;
+};
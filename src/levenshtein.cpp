@@ -8,7 +8,99 @@ using namespace std;
 
 static constexpr uint8_t max_edit_distance = numeric_limits<uint8_t>().max();
 
-uint Levenshtein::computePrefixEditDistanceWithLimit(const QString &prefix, const QString &string, uint k)
+uint Levenshtein::computePrefixEditDistanceWithLimit(QStringView prefix, QStringView string, uint k)
+{
+    if (prefix.size() <= 64)
+        return computePrefixEditDistanceWithLimit_BitParallel(prefix, string, k);
+    else
+        return computePrefixEditDistanceWithLimit_DP(prefix, string, k);
+}
+
+void Levenshtein::updatePatternMasks(QStringView prefix)
+{
+    if (prefix == mask_prefix)
+        return;
+
+    for (const QChar &c : mask_prefix)
+        if (c.unicode() < 256)
+            latin1_masks[c.unicode()] = 0;
+    other_masks.clear();
+
+    for (qsizetype i = 0; i < prefix.size(); ++i) {
+        const auto c = prefix[i].unicode();
+        if (c < 256)
+            latin1_masks[c] |= (uint64_t)1 << i;
+        else if (auto it = find_if(other_masks.begin(), other_masks.end(),
+                                   [c](const auto &p){ return p.first == c; }); it != other_masks.end())
+            it->second |= (uint64_t)1 << i;
+        else
+            other_masks.emplace_back(c, (uint64_t)1 << i);
+    }
+
+    mask_prefix = prefix.toString();
+}
+
+uint64_t Levenshtein::patternMask(QChar c) const
+{
+    if (c.unicode() < 256)
+        return latin1_masks[c.unicode()];
+    for (const auto &[other, mask] : other_masks)
+        if (other == c.unicode())
+            return mask;
+    return 0;
+}
+
+uint Levenshtein::computePrefixEditDistanceWithLimit_BitParallel(QStringView prefix, QStringView string, uint k)
+{
+    if (k == 0)
+        return string.startsWith(prefix) ? 0 : 1;
+
+    if (prefix.size() > string.size()+k)
+        return k+1;
+
+    const uint m = prefix.size();
+    if (m == 0)
+        return 0;
+
+    updatePatternMasks(prefix);
+
+    // Columns of the DP matrix are encoded as vertical deltas (+1: Pv, -1: Mv).
+    // The score tracks the last row, i.e. the distance of prefix to string[0,j).
+    // The first row increases by one per column (global alignment), hence the
+    // 1 shifted into the horizontal positive delta.
+    const uint64_t last_row = (uint64_t)1 << (m - 1);
+    uint64_t pv = ~(uint64_t)0, mv = 0;
+    uint score = m, min_score = m;
+
+    // Beyond m+k columns the distance exceeds k
+    const auto cols = min<qsizetype>(string.size(), m + k);
+    for (qsizetype j = 0; j < cols; ++j) {
+        const uint64_t eq = patternMask(string[j]);
+        const uint64_t xv = eq | mv;
+        const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+
+        if (ph & last_row)
+            ++score;
+        else if (mh & last_row)
+            --score;
+        min_score = min(min_score, score);
+
+        // The score decreases by at most one per column
+        if (score >= min(min_score, k + 1) + (cols - 1 - j))
+            break;
+
+        ph = (ph << 1) | 1;
+        mh = mh << 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+    }
+
+    return min(min_score, k + 1);
+}
+
+uint Levenshtein::computePrefixEditDistanceWithLimit_DP(QStringView prefix, QStringView string, uint k)
 {
     if (k == 0)
         return string.startsWith(prefix) ? 0 : 1;
@@ -16,6 +108,9 @@ uint Levenshtein::computePrefixEditDistanceWithLimit(const QString &prefix, cons
     if (prefix.size() > string.size()+k)
         return k+1;
 
+    if (string.isEmpty())
+        return min<uint>(prefix.size(), k+1);
+
     uint rows = prefix.size() + 1;
     uint cols = min(prefix.size() + (qsizetype)k + 1, string.size() + 1);
 
@@ -41,7 +136,7 @@ uint Levenshtein::computePrefixEditDistanceWithLimit(const QString &prefix, cons
     //g │ 7 │                 3  (2)  3 │ 4   5 │
     //  └───┴───────────────────────────┴───────┘
 
-    uint8_t edit_distance;
+    uint8_t edit_distance = 0;
     for (uint r=1; r < rows; ++r) {
         edit_distance = max_edit_distance;
 
@@ -59,7 +154,7 @@ uint Levenshtein::computePrefixEditDistanceWithLimit(const QString &prefix, cons
                                  cell(r - 1, c) + 1u, cell(r, c - 1) + 1u})
             );
 
-        if (r<cols-k)
+        if (r+k < cols)
             edit_distance = min(
                 edit_distance,
                 cell(r, r + k) = min({cell(r - 1, r + k - 1) + (prefix[r-1] == string[r + k-1] ? 0u : 1u),
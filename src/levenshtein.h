@@ -2,20 +2,39 @@
 
 #pragma once
 #include <QString>
+#include <array>
+#include <cstdint>
+#include <utility>
 #include <vector>
 
 // Fast allocation-avoiding Levenshtein distance
 // See https://doi.org/10.1137/S0097539794264810
+// Bit-parallel variant see https://doi.org/10.1145/316542.316550 and
+// Hyyrö, "Explaining and extending the bit-parallel approximate string
+// matching algorithm of Myers", 2001.
 class Levenshtein
 {
 public:
     /// Fast computation of Levenshtein distance from prefix to string up to a max of max_delta
-    /// @note Requires prefix.size < str.size. No bounds are checked!
+    /// Uses the bit-parallel algorithm for prefixes up to 64 chars, the banded DP otherwise.
+    /// @note Reuse the instance for the same prefix, the pattern bitmasks are cached.
     /// @return The error count up to max_delta. If there are more errors, always returns max_delta+1.
-    uint computePrefixEditDistanceWithLimit(const QString &prefix, const QString &string, uint k);
+    uint computePrefixEditDistanceWithLimit(QStringView prefix, QStringView string, uint k);
+    uint computePrefixEditDistanceWithLimit(const QString &prefix, const QString &string, uint k)
+    { return computePrefixEditDistanceWithLimit(QStringView(prefix), QStringView(string), k); }
+
+    /// Banded dynamic programming. Any prefix length.
+    uint computePrefixEditDistanceWithLimit_DP(QStringView prefix, QStringView string, uint k);
+
+    /// Bit-parallel (Myers/Hyyrö). Requires prefix.size() <= 64.
+    uint computePrefixEditDistanceWithLimit_BitParallel(QStringView prefix, QStringView string, uint k);
+
     static bool checkPrefixEditDistance_Legacy(const QString &prefix, const QString &str, uint delta);
 
 private:
+    void updatePatternMasks(QStringView prefix);
+    inline uint64_t patternMask(QChar c) const;
+
     inline uint8_t &cell(uint r, uint c) ;
     inline const uint8_t &cell(uint r, uint c) const;
     void expand_matrix_if_necessary(uint rows, uint cols);
@@ -26,4 +45,9 @@ private:
     uint matrix_rows = 0;
     uint matrix_cols = 0;
 
+    // Per char bitmask of its positions in the prefix
+    QString mask_prefix;
+    std::array<uint64_t, 256> latin1_masks{};
+    std::vector<std::pair<char16_t, uint64_t>> other_masks;
+
 };
@@ -0,0 +1,194 @@
+// Copyright (c) 2023 Manuel Schneider
+
+#include "iconcache.h"
+#include "themefileparser.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+namespace {
+
+// File layout: header, entries, strings (utf-16). Native byte order.
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint64_t stamp;
+    uint64_t string_size;  // In code units
+};
+
+const char MAGIC[8] = "ALBICON";
+const uint32_t VERSION = 3;
+
+}
+
+XDG::IconCache::IconCache(const QString &path, const QStringList &icon_dirs)
+    : file_path_(path), stamp_(stamp(icon_dirs)), file_(path)
+{
+    if (!load()) {
+        entries_ = {};
+        strings_ = {};
+        file_.close();
+    }
+}
+
+XDG::IconCache::~IconCache()
+{
+    if (modified_)
+        save();
+}
+
+uint64_t XDG::IconCache::stamp(const QStringList &icon_dirs)
+{
+    // FNV-1a of the paths and modification times of the icon dirs, the theme
+    // dirs and the theme subdirectories, which icons get installed into. A few
+    // thousand stats at most instead of one per lookup candidate.
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](const void *data, size_t size){
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ static_cast<const unsigned char*>(data)[i]) * 1099511628211ull;
+    };
+    auto add_dir = [&add](const QString &dir){
+        const qint64 mtime = QFileInfo(dir).lastModified().toMSecsSinceEpoch();
+        add(dir.constData(), (size_t)dir.size() * sizeof(QChar));
+        add(&mtime, sizeof(mtime));
+    };
+    map<QString, QStringList> themes;  // Name > icon dirs containing it
+    for (const auto &icon_dir : icon_dirs) {
+        add_dir(icon_dir);
+        QDir dir(icon_dir);
+        for (const auto &theme_dir : dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name)) {
+            add_dir(dir.filePath(theme_dir));
+            themes[theme_dir] << icon_dir;
+        }
+    }
+
+    // Subdirectories as listed in the first theme file, like the lookup does
+    for (const auto &[theme, theme_icon_dirs] : themes)
+        for (const auto &icon_dir : theme_icon_dirs)
+            if (const auto theme_file = QString("%1/%2/index.theme").arg(icon_dir, theme);
+                    QFile::exists(theme_file)) {
+                for (const auto &subdir : ThemeFileParser(theme_file).directories())
+                    for (const auto &subdir_icon_dir : theme_icon_dirs)
+                        add_dir(QString("%1/%2/%3").arg(subdir_icon_dir, theme, subdir));
+                break;
+            }
+
+    return hash;
+}
+
+QStringView XDG::IconCache::string(uint32_t offset, uint32_t size) const
+{ return QStringView(strings_.data() + offset, size); }
+
+bool XDG::IconCache::load()
+{
+    if (!file_.open(QIODevice::ReadOnly) || file_.size() < (qint64)sizeof(Header))
+        return false;
+    const auto size = (uint64_t)file_.size();
+    const uchar *map = file_.map(0, file_.size());
+    if (!map)
+        return false;
+
+    Header header;
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0
+        || header.version != VERSION
+        || header.stamp != stamp_
+        || (size - sizeof(Header)) / sizeof(Entry) < header.entry_count
+        || (size - sizeof(Header) - header.entry_count * sizeof(Entry)) / sizeof(char16_t) != header.string_size)
+        return false;
+
+    entries_ = span(reinterpret_cast<const Entry*>(map + sizeof(Header)), header.entry_count);
+    strings_ = span(reinterpret_cast<const char16_t*>(map + sizeof(Header) + header.entry_count * sizeof(Entry)),
+                    header.string_size);
+
+    auto valid = [this](uint32_t offset, uint32_t length){
+        return offset <= strings_.size() && length <= strings_.size() - offset;
+    };
+    return ranges::all_of(entries_, [&](const Entry &e){
+        return valid(e.theme_offset, e.theme_size) && valid(e.icon_offset, e.icon_size)
+               && valid(e.path_offset, e.path_size);
+    });
+}
+
+optional<QString> XDG::IconCache::iconPath(const QString &theme, const QString &icon, int size) const
+{
+    if (auto it = added_.find(make_tuple(theme, icon, size)); it != added_.end())
+        return it->second;
+
+    auto less = [this, &theme, &icon, size](const Entry &e, nullptr_t){
+        if (const auto c = string(e.theme_offset, e.theme_size).compare(theme); c != 0)
+            return c < 0;
+        if (const auto c = string(e.icon_offset, e.icon_size).compare(icon); c != 0)
+            return c < 0;
+        return e.size < size;
+    };
+    if (auto it = lower_bound(entries_.begin(), entries_.end(), nullptr, less);
+            it != entries_.end()
+            && string(it->theme_offset, it->theme_size) == theme
+            && string(it->icon_offset, it->icon_size) == icon
+            && it->size == size)
+        return string(it->path_offset, it->path_size).toString();
+
+    return {};
+}
+
+void XDG::IconCache::insert(const QString &theme, const QString &icon, int size, const QString &path)
+{
+    added_.insert_or_assign(make_tuple(theme, icon, size), path);
+    modified_ = true;
+}
+
+bool XDG::IconCache::save()
+{
+    map<tuple<QString, QString, int>, QString> entries(added_);
+    for (const auto &e : entries_)
+        entries.emplace(make_tuple(string(e.theme_offset, e.theme_size).toString(),
+                                   string(e.icon_offset, e.icon_size).toString(), e.size),
+                        string(e.path_offset, e.path_size).toString());
+
+    // Strings are stored once, themes and paths repeat a lot
+    vector<Entry> file_entries;
+    vector<char16_t> strings;
+    unordered_map<QString, uint32_t> string_offsets;
+    auto intern = [&](const QString &s){
+        auto [it, inserted] = string_offsets.emplace(s, (uint32_t)strings.size());
+        if (inserted)
+            strings.insert(strings.end(), reinterpret_cast<const char16_t*>(s.constData()),
+                           reinterpret_cast<const char16_t*>(s.constData()) + s.size());
+        return it->second;
+    };
+    file_entries.reserve(entries.size());
+    for (const auto &[key, path] : entries) {  // Sorted by (theme, icon, size)
+        const auto &[theme, icon, size] = key;
+        file_entries.push_back({intern(theme), (uint32_t)theme.size(),
+                                intern(icon), (uint32_t)icon.size(),
+                                intern(path), (uint32_t)path.size(), size});
+    }
+
+    Header header{};
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.entry_count = (uint32_t)file_entries.size();
+    header.stamp = stamp_;
+    header.string_size = strings.size();
+
+    QSaveFile file(file_path_);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(file_entries.data()), (qint64)(file_entries.size() * sizeof(Entry)));
+    file.write(reinterpret_cast<const char*>(strings.data()), (qint64)(strings.size() * sizeof(char16_t)));
+    if (!file.commit())
+        return false;
+
+    modified_ = false;
+    return true;
+}
@@ -0,0 +1,54 @@
+// Copyright (c) 2023 Manuel Schneider
+
+#pragma once
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <map>
+#include <optional>
+#include <span>
+#include <tuple>
+
+namespace XDG {
+
+/**
+ * @brief Persistent cache of icon lookup results
+ *
+ * Maps (theme, icon name, size) to the icon path found. Misses are not cached.
+ * The file of the previous session is mapped and binary searched in place. It
+ * is valid as long as the modification times of the icon directories, their
+ * theme directories and the theme subdirectories did not change, i.e. no theme
+ * or icon got installed, removed or updated.
+ */
+class IconCache
+{
+public:
+    IconCache(const QString &path, const QStringList &icon_dirs);
+    ~IconCache();  ///< Saves new entries
+
+    std::optional<QString> iconPath(const QString &theme, const QString &icon, int size) const;
+    void insert(const QString &theme, const QString &icon, int size, const QString &path);
+    bool save();  ///< Writes the mapped and the added entries
+
+private:
+    struct Entry {  // Ranges of the string arena
+        uint32_t theme_offset, theme_size;
+        uint32_t icon_offset, icon_size;
+        uint32_t path_offset, path_size;
+        int32_t size;
+    };
+
+    static uint64_t stamp(const QStringList &icon_dirs);
+    QStringView string(uint32_t offset, uint32_t size) const;
+    bool load();
+
+    const QString file_path_;
+    const uint64_t stamp_;
+    QFile file_;
+    std::span<const Entry> entries_;  // Mapped, sorted by (theme, icon, size)
+    std::span<const char16_t> strings_;  // Mapped
+    std::map<std::tuple<QString, QString, int>, QString> added_;  // Not in the mapped file
+    bool modified_ = false;
+};
+
+}
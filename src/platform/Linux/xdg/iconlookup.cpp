@@ -2,56 +2,143 @@
 
 #include <QDebug>
 #include <QDir>
-#include <QFileInfo>
+#include <QFile>
 #include <QIcon>
 #include <QStandardPaths>
 #include <QString>
-#include "themefileparser.h"
+#include <algorithm>
+#include <climits>
+#include <dirent.h>
+#include <vector>
+#include "albert/albert.h"
+#include "iconcache.h"
 #include "iconlookup.h"
+#include "themefileparser.h"
 using namespace std;
 
 namespace  {
     QStringList icon_extensions = {"png", "svg", "xpm"};
+    const char *cache_file_name = "iconlookup.cache";
+
+    // Calls f(name, extension index) for the icon files in dir. One readdir,
+    // no stats. Returns false if dir can not be read.
+    template<class F>
+    bool listIcons(const QString &dir, F f)
+    {
+        DIR *d = opendir(QFile::encodeName(dir).constData());
+        if (!d)
+            return false;
+        while (const dirent *entry = readdir(d)) {
+            QString name = QFile::decodeName(entry->d_name);
+            if (name.size() > 4 && name[name.size() - 4] == '.')
+                for (uint e = 0; e < (uint)icon_extensions.size(); ++e)
+                    if (QStringView(name).last(3) == icon_extensions[e]) {
+                        name.chop(4);
+                        f(name, e);
+                        break;
+                    }
+        }
+        closedir(d);
+        return true;
+    }
+}
+
+struct XDG::IconLookup::Theme
+{
+    enum class Type { Fixed, Scalable, Threshold };
+
+    struct Directory {
+        QString path;
+        Type type;
+        int size;
+        int min_size;
+        int max_size;
+        int threshold;
+
+        // See the icon theme spec, DirectoryMatchesSize and DirectorySizeDistance
+        bool matchesSize(int s) const;
+        int sizeDistance(int s) const;
+    };
+
+    struct Icon {
+        uint directory;
+        uint extension;
+    };
+
+    QStringList inherits;
+    vector<Directory> directories;  // In lookup order
+    unordered_map<QString, vector<Icon>> icons;  // Name > files, in lookup order
+};
+
+bool XDG::IconLookup::Theme::Directory::matchesSize(int s) const
+{
+    switch (type) {
+    case Type::Fixed: return s == size;
+    case Type::Scalable: return min_size <= s && s <= max_size;
+    case Type::Threshold: return size - threshold <= s && s <= size + threshold;
+    }
+    return false;
 }
 
-QString XDG::IconLookup::iconPath(QString iconName, QSize , QString themeName)  // FIXME unused qsize
+int XDG::IconLookup::Theme::Directory::sizeDistance(int s) const
 {
-    return instance()->themeIconPath(iconName, themeName);
+    switch (type) {
+    case Type::Fixed:
+        return abs(size - s);
+    case Type::Scalable:
+        return s < min_size ? min_size - s : s > max_size ? s - max_size : 0;
+    case Type::Threshold:
+        return s < size - threshold ? size - threshold - s : s > size + threshold ? s - size - threshold : 0;
+    }
+    return INT_MAX;
 }
 
-XDG::IconLookup::IconLookup()
+QString XDG::IconLookup::iconPath(QString iconName, QSize size, QString themeName)
 {
-    /*
-     * Icons and themes are looked for in a set of directories. By default,
-     * apps should look in $HOME/.icons (for backwards compatibility), in
-     * $XDG_DATA_DIRS/icons and in /usr/share/pixmaps (in that order).
-     */
-
-    QString path = QDir::home().filePath(".icons");
-    if (QFile::exists(path))
-        iconDirs_.append(path);
-
-    for (const QString &basedir : QStandardPaths::standardLocations(QStandardPaths::GenericDataLocation))
-        if (QFile::exists(path = QDir(basedir).filePath("icons")))
-            iconDirs_.append(path);
-
-    // Not in spec, but for tolerance
-    if (path = QStringLiteral("/usr/local/share/pixmaps"); QFile::exists(path))
-        iconDirs_.append(path);
-
-    if (path = QStringLiteral("/usr/share/pixmaps"); QFile::exists(path))
-        iconDirs_.append(path);
+    auto *lookup = instance();
+    std::lock_guard lock(lookup->mutex_);
+    return lookup->themeIconPath(iconName, size.isValid() ? max(size.width(), size.height()) : 0, themeName);
 }
 
+XDG::IconLookup::IconLookup(QStringList iconDirs, const QString &cacheFile) : iconDirs_(::move(iconDirs))
+{
+    if (!cacheFile.isEmpty())
+        iconCache_ = make_unique<IconCache>(cacheFile, iconDirs_);
+}
+
+XDG::IconLookup::~IconLookup() = default;
+
 XDG::IconLookup *XDG::IconLookup::instance()
 {
-    static IconLookup *instance_ = nullptr;
-    if (!instance_)
-        instance_ = new IconLookup();
-    return instance_;
+    static IconLookup instance_ = []{
+        /*
+         * Icons and themes are looked for in a set of directories. By default,
+         * apps should look in $HOME/.icons (for backwards compatibility), in
+         * $XDG_DATA_DIRS/icons and in /usr/share/pixmaps (in that order).
+         */
+        QStringList iconDirs;
+
+        QString path = QDir::home().filePath(".icons");
+        if (QFile::exists(path))
+            iconDirs.append(path);
+
+        for (const QString &basedir : QStandardPaths::standardLocations(QStandardPaths::GenericDataLocation))
+            if (QFile::exists(path = QDir(basedir).filePath("icons")))
+                iconDirs.append(path);
+
+        // Not in spec, but for tolerance
+        if (path = QStringLiteral("/usr/local/share/pixmaps"); QFile::exists(path))
+            iconDirs.append(path);
+
+        if (path = QStringLiteral("/usr/share/pixmaps"); QFile::exists(path))
+            iconDirs.append(path);
+
+        return IconLookup(iconDirs, QDir(albert::cacheLocation()).filePath(cache_file_name));
+    }();  // Destructed on exit, saves the cache
+    return &instance_;
 }
 
-QString XDG::IconLookup::themeIconPath(QString iconName, QString themeName)
+QString XDG::IconLookup::themeIconPath(QString iconName, int size, QString themeName)
 {
     if (iconName.isEmpty())
         return {};
@@ -73,33 +160,39 @@ QString XDG::IconLookup::themeIconPath(QString iconName, QString themeName)
             iconName.chop(4);
 
     // Check cache
-    try {
-        return iconCache_.at(iconName);
-    } catch (const out_of_range &) {}
+    if (iconCache_)
+        if (auto cached = iconCache_->iconPath(themeName, iconName, size))
+            return *cached;
+
+    auto cache = [&](const QString &path){
+        if (iconCache_)
+            iconCache_->insert(themeName, iconName, size, path);
+        return path;
+    };
 
     QStringList checkedThemes;
     QString iconPath;
 
     // Lookup themefile
-    if (!(iconPath = doRecursiveIconLookup(iconName, themeName, &checkedThemes)).isNull())
-        return iconCache_.emplace(iconName, iconPath).first->second;
+    if (!(iconPath = doRecursiveIconLookup(iconName, size, themeName, &checkedThemes)).isNull())
+        return cache(iconPath);
 
     // Lookup in hicolor
     if (!checkedThemes.contains("hicolor"))
-        if (!(iconPath = doRecursiveIconLookup(iconName, "hicolor", &checkedThemes)).isNull())
-            return iconCache_.emplace(iconName, iconPath).first->second;
+        if (!(iconPath = doRecursiveIconLookup(iconName, size, "hicolor", &checkedThemes)).isNull())
+            return cache(iconPath);
 
     // Now search unsorted
-    for (const QString &iconDir: iconDirs_)
-        for (const QString &ext: icon_extensions)
-            if (QFile(iconPath = QString("%1/%2.%3").arg(iconDir, iconName, ext)).exists())
-                return iconCache_.emplace(iconName, iconPath).first->second;
+    if (!(iconPath = doUnsortedIconLookup(iconName)).isNull())
+        return cache(iconPath);
 
-    // Nothing found, save though to avoid repeated expensive lookups
-    return iconCache_.emplace(iconName, QString()).first->second;
+    // Nothing found. Not cached, the directory indices of this session answer
+    // repeated misses without touching the disk.
+    return {};
 }
 
-QString XDG::IconLookup::doRecursiveIconLookup(const QString &iconName, const QString &themeName, QStringList *checked)
+QString XDG::IconLookup::doRecursiveIconLookup(const QString &iconName, int size, const QString &themeName,
+                                               QStringList *checked)
 {
     // Exlude multiple scans
     if (checked->contains(themeName))
@@ -107,19 +200,19 @@ QString XDG::IconLookup::doRecursiveIconLookup(const QString &iconName, const QS
     checked->append(themeName);
 
     // Check if theme exists
-    QString themeFile = lookupThemeFile(themeName);
-    if (themeFile.isNull())
+    const Theme *theme_ = theme(themeName);
+    if (!theme_)
         return {};
 
     // Check if icon exists
     QString iconPath;
-    iconPath = doIconLookup(iconName, themeFile);
+    iconPath = doIconLookup(iconName, size, *theme_);
     if (!iconPath.isNull())
         return iconPath;
 
     // Check its parents too
-    for (const QString &parent: ThemeFileParser(themeFile).inherits()) {
-        iconPath = doRecursiveIconLookup(iconName, parent, checked);
+    for (const QString &parent: theme_->inherits) {
+        iconPath = doRecursiveIconLookup(iconName, size, parent, checked);
         if (!iconPath.isNull())
             return iconPath;
     }
@@ -127,40 +220,104 @@ QString XDG::IconLookup::doRecursiveIconLookup(const QString &iconName, const QS
     return {};
 }
 
-QString XDG::IconLookup::doIconLookup(const QString &iconName, const QString &themeFile)
+QString XDG::IconLookup::doIconLookup(const QString &iconName, int size, const Theme &theme)
 {
-    ThemeFileParser themeFileParser(themeFile);
-    QDir themeDir = QFileInfo(themeFile).dir();
-    QString themeName = themeDir.dirName();
-
-    // Get the sizes of the dirs
-    vector<pair<QString, int>> dirsAndSizes;
-    for (const QString &subdir: themeFileParser.directories())
-        dirsAndSizes.push_back(make_pair(subdir, themeFileParser.size(subdir)));
-
-    // Sort them by size
-    sort(dirsAndSizes.begin(), dirsAndSizes.end(),
-         [](pair<QString, int> a, pair<QString, int> b) {
-             return a.second > b.second;
-         });
-
-    // Well now search for a file beginning with the greatest
-    QString filename;
-    QFile file;
-    for (const auto &dirAndSize: dirsAndSizes) {
-        for (const QString &iconDir: iconDirs_) {
-            for (const QString &ext: icon_extensions) {
-                filename = QString("%1/%2/%3/%4.%5").arg(iconDir, themeName, dirAndSize.first, iconName, ext);
-                if (file.exists(filename)) {
-                    return filename;
-                }
+    const auto it = theme.icons.find(iconName);
+    if (it == theme.icons.end())
+        return {};
+    const auto &icons = it->second;
+
+    const Theme::Icon *icon = nullptr;
+    if (size <= 0)
+        // No size requested, take the largest
+        icon = &*max_element(icons.begin(), icons.end(), [&](const auto &l, const auto &r){
+            return theme.directories[l.directory].size < theme.directories[r.directory].size;
+        });
+    else {
+        // The first matching the size, otherwise the closest
+        int minimal_distance = INT_MAX;
+        for (const auto &candidate : icons) {
+            const auto &directory = theme.directories[candidate.directory];
+            if (directory.matchesSize(size)) {
+                icon = &candidate;
+                break;
+            }
+            if (auto distance = directory.sizeDistance(size); distance < minimal_distance) {
+                minimal_distance = distance;
+                icon = &candidate;
             }
         }
     }
 
+    return QString("%1/%2.%3").arg(theme.directories[icon->directory].path, iconName,
+                                   icon_extensions[icon->extension]);
+}
+
+QString XDG::IconLookup::doUnsortedIconLookup(const QString &iconName)
+{
+    // Index the icons of all icon dirs at once. Earlier dirs and extensions take precedence.
+    if (!unsortedIconsIndexed_) {
+        for (uint d = 0; d < (uint)iconDirs_.size(); ++d)
+            listIcons(iconDirs_[d], [&](const QString &name, uint extension){
+                const uint priority = d * icon_extensions.size() + extension;
+                auto [it, emplaced] = unsortedIcons_.try_emplace(name, priority, QString());
+                if (emplaced || priority < it->second.first)
+                    it->second = {priority, QString("%1/%2.%3").arg(iconDirs_[d], name, icon_extensions[extension])};
+            });
+        unsortedIconsIndexed_ = true;
+    }
+
+    if (auto it = unsortedIcons_.find(iconName); it != unsortedIcons_.end())
+        return it->second.second;
     return {};
 }
 
+const XDG::IconLookup::Theme *XDG::IconLookup::theme(const QString &themeName)
+{
+    if (auto it = themes_.find(themeName); it != themes_.end())
+        return it->second.get();
+
+    auto &theme_ = themes_[themeName];
+
+    QString themeFile = lookupThemeFile(themeName);
+    if (themeFile.isNull())
+        return nullptr;
+
+    ThemeFileParser themeFileParser(themeFile);
+    theme_ = make_unique<Theme>();
+    theme_->inherits = themeFileParser.inherits();
+
+    // List every directory once instead of probing each (dir, name, extension)
+    for (const QString &subdir: themeFileParser.directories()) {
+        Theme::Directory directory;
+        const auto type = themeFileParser.type(subdir);
+        directory.type = type == QStringLiteral("Fixed") ? Theme::Type::Fixed
+                         : type == QStringLiteral("Scalable") ? Theme::Type::Scalable
+                                                              : Theme::Type::Threshold;
+        directory.size = themeFileParser.size(subdir);
+        directory.min_size = themeFileParser.minSize(subdir);
+        directory.max_size = themeFileParser.maxSize(subdir);
+        directory.threshold = themeFileParser.threshold(subdir);
+
+        for (const QString &iconDir: iconDirs_) {
+            directory.path = QString("%1/%2/%3").arg(iconDir, themeName, subdir);
+            const auto index = (uint)theme_->directories.size();
+            if (listIcons(directory.path, [&](const QString &name, uint extension){
+                    theme_->icons[name].push_back({index, extension});
+                }))
+                theme_->directories.push_back(directory);
+        }
+    }
+
+    // Extensions in lookup order too
+    for (auto &[name, icons] : theme_->icons)
+        sort(icons.begin(), icons.end(), [](const auto &l, const auto &r){
+            return l.directory == r.directory ? l.extension < r.extension : l.directory < r.directory;
+        });
+
+    return theme_.get();
+}
+
 QString XDG::IconLookup::lookupThemeFile(const QString &themeName)
 {
     // Lookup themefile
@@ -4,9 +4,14 @@
 #include <QSize>
 #include <QStringList>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace XDG {
 
+class IconCache;
+
 class IconLookup
 {
 public:
@@ -14,23 +19,43 @@ public:
     /**
      * @brief iconPath Does XDG icon lookup for the given icon name
      * @param iconName The icon name to lookup
+     * @param size The requested size. The largest icon if invalid.
      * @param themeName The theme to use, use current theme if empty
      * @return If an icon was found the path to the icon, else an empty string
      */
     static QString iconPath(QString iconName, QSize size = QSize(), QString themeName = QString());
 
+    /**
+     * @brief Creates a lookup searching the given icon dirs
+     * @param iconDirs The base dirs containing themes and unsorted icons
+     * @param cacheFile The persistent cache file, none if empty
+     */
+    IconLookup(QStringList iconDirs, const QString &cacheFile);
+    ~IconLookup();
+
+    /// @see iconPath. Not thread safe.
+    QString themeIconPath(QString iconName, int size = 0, QString themeName = QString());
+
 private:
 
-    IconLookup();
+    // Directories and icons of a theme. Built on first use from the theme
+    // file and a listing of every theme directory.
+    struct Theme;
+
     static IconLookup *instance();
 
-    QString themeIconPath(QString iconName, QString themeName = QString());
-    QString doRecursiveIconLookup(const QString &iconName, const QString &theme, QStringList *checked);
-    QString doIconLookup(const QString &iconName, const QString &themeFile);
+    QString doRecursiveIconLookup(const QString &iconName, int size, const QString &themeName, QStringList *checked);
+    QString doIconLookup(const QString &iconName, int size, const Theme &theme);
+    QString doUnsortedIconLookup(const QString &iconName);
+    const Theme *theme(const QString &themeName);
     QString lookupThemeFile(const QString &themeName);
 
     QStringList iconDirs_;
-    std::map<QString, QString> iconCache_;
+    std::unique_ptr<IconCache> iconCache_;  // Keyed by theme, icon name and size
+    std::map<QString, std::unique_ptr<Theme>> themes_;  // Null if not installed
+    std::unordered_map<QString, std::pair<uint, QString>> unsortedIcons_;  // Name > (priority, path)
+    bool unsortedIconsIndexed_ = false;
+    std::mutex mutex_;  // Serializes the static lookups
 };
 
 }
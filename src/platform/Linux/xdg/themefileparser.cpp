@@ -69,19 +69,19 @@ QString XDG::ThemeFileParser::type(const QString &directory)
 int XDG::ThemeFileParser::maxSize(const QString &directory)
 {
     iniFile_.beginGroup(directory);
-    int result = iniFile_.contains("MaxSize") ? iniFile_.value("MaxSize").toInt()
-                                              : size(directory);
+    const bool contains = iniFile_.contains("MaxSize");
+    int result = iniFile_.value("MaxSize").toInt();
     iniFile_.endGroup();
-    return result;
+    return contains ? result : size(directory);  // Not within the group
 }
 
 int XDG::ThemeFileParser::minSize(const QString &directory)
 {
     iniFile_.beginGroup(directory);
-    int result = iniFile_.contains("MinSize") ? iniFile_.value("MinSize").toInt()
-                                              : size(directory);
+    const bool contains = iniFile_.contains("MinSize");
+    int result = iniFile_.value("MinSize").toInt();
     iniFile_.endGroup();
-    return result;
+    return contains ? result : size(directory);  // Not within the group
 }
 
 int XDG::ThemeFileParser::threshold(const QString &directory)
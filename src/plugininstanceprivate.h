@@ -8,6 +8,6 @@ class PluginInstancePrivate
 {
 public:
     PluginLoader const * const loader{in_construction};
-    inline static const PluginLoader *in_construction;
+    inline static thread_local const PluginLoader *in_construction;  // Plugins may load concurrently
 };
 
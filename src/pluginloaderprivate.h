@@ -8,6 +8,7 @@
 #include "albert/util/timeprinter.h"
 #include "plugininstanceprivate.h"
 #include <QCoreApplication>
+#include <chrono>
 using namespace albert;
 using namespace std;
 
@@ -18,6 +19,7 @@ public:
     PluginLoader *q;
     QString state_info{};
     PluginState state{PluginState::Unloaded};
+    std::chrono::microseconds load_duration{};  // Of the latest load
 
     PluginLoaderPrivate(PluginLoader *l) : q(l)
     {
@@ -42,42 +44,71 @@ public:
                 QCoreApplication::processEvents();
 
                 setState(PluginState::Busy, QStringLiteral("Loading…"));
-                TimePrinter tp(QString("[%1 ms] spent loading plugin '%2'").arg("%1", q->metaData().id));
+                return finishLoad(registry, loadInstance(registry));
+            }
+        }
+        return {};
+    }
 
-                QStringList errors;
+    // First phase of loading a Busy plugin. Loads and initializes the
+    // instance. Thread safe if the plugin is. Returns the errors, if any.
+    QStringList loadInstance(ExtensionRegistry *registry)
+    {
+        const auto begin = chrono::steady_clock::now();
+        QStringList errors;
 
-                try {
-                    PluginInstancePrivate::in_construction = q;
-                    if (auto err = q->load(); err.isEmpty()){
-                        if (auto *p_instance = q->instance()){
+        try {
+            PluginInstancePrivate::in_construction = q;
+            if (auto err = q->load(); err.isEmpty()){
+                if (auto *p_instance = q->instance()){
 
-                            p_instance->initialize(registry);
-                            for (auto *e : p_instance->extensions())
-                                registry->add(e);
+                    p_instance->initialize(registry);
 
-                            setState(PluginState::Loaded);
-                            return {};
+                    // Loaded in a background thread, the plugin belongs to the app though
+                    if (auto *object = dynamic_cast<QObject*>(p_instance);
+                            object && object->thread() != QCoreApplication::instance()->thread())
+                        object->moveToThread(QCoreApplication::instance()->thread());
 
-                        } else
-                            errors << "Plugin laoded successfully but returned nullptr instance.";
-                    } else
-                        errors << err;
+                    load_duration = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin);
+                    return {};
 
-                    if (auto err = q->unload(); !err.isNull())
-                        errors << err;
+                } else
+                    errors << "Plugin laoded successfully but returned nullptr instance.";
+            } else
+                errors << err;
 
-                } catch (const exception& e) {
-                    errors << e.what();
-                } catch (...) {
-                    errors << "Unknown exception while loading plugin.";
-                }
+            if (auto err = q->unload(); !err.isNull())
+                errors << err;
 
-                auto err_str = errors.join("\n");
-                setState(PluginState::Unloaded, err_str);
-                return err_str;
-            }
+        } catch (const exception& e) {
+            errors << e.what();
+        } catch (...) {
+            errors << "Unknown exception while loading plugin.";
         }
-        return {};
+
+        return errors;
+    }
+
+    // Second phase of loading. Registers the extensions of the instance
+    // or resets the state on errors. GUI thread only.
+    QString finishLoad(ExtensionRegistry *registry, const QStringList &errors)
+    {
+        if (errors.isEmpty()){
+            const auto begin = chrono::steady_clock::now();
+            for (auto *e : q->instance()->extensions())
+                registry->add(e);
+            load_duration += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin);
+
+            DEBG << QString("[%1 ms] spent loading plugin '%2'")
+                        .arg(chrono::duration_cast<chrono::milliseconds>(load_duration).count(), 6)
+                        .arg(q->metaData().id);
+            setState(PluginState::Loaded);
+            return {};
+        }
+
+        auto err_str = errors.join("\n");
+        setState(PluginState::Unloaded, err_str);
+        return err_str;
     }
 
     QString unload(ExtensionRegistry *registry)
@@ -0,0 +1,125 @@
+// Copyright (c) 2023 Manuel Schneider
+
+#include "albert/config.h"
+#include "albert/logging.h"
+#include "pluginmetadatacache.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <algorithm>
+using namespace albert;
+using namespace std;
+
+static const quint32 CACHE_MAGIC = 0x414c4250;  // "ALBP"
+static const quint32 CACHE_VERSION = 2;
+
+static QDataStream &operator<<(QDataStream &stream, const PluginMetaData &m)
+{
+    return stream << m.iid << m.id << m.version << m.name << m.description << m.long_description
+                  << m.license << m.url << m.maintainers << m.runtime_dependencies
+                  << m.binary_dependencies << m.third_party_credits << m.platforms
+                  << m.plugin_dependencies << (qint32)m.load_type << m.thread_safe;
+}
+
+static QDataStream &operator>>(QDataStream &stream, PluginMetaData &m)
+{
+    qint32 load_type;
+    stream >> m.iid >> m.id >> m.version >> m.name >> m.description >> m.long_description
+           >> m.license >> m.url >> m.maintainers >> m.runtime_dependencies
+           >> m.binary_dependencies >> m.third_party_credits >> m.platforms
+           >> m.plugin_dependencies >> load_type >> m.thread_safe;
+    m.load_type = static_cast<LoadType>(load_type);
+    return stream;
+}
+
+PluginMetaDataCache::PluginMetaDataCache(const QString &path) : path_(path)
+{
+    if (!load()) {
+        records_.clear();
+        modified_ = true;
+    }
+}
+
+PluginMetaDataCache::~PluginMetaDataCache()
+{
+    if (modified_ || any_of(records_.begin(), records_.end(),
+                            [](const auto &r){ return !r.second.used; }))
+        save();
+}
+
+optional<PluginMetaDataCache::Entry> PluginMetaDataCache::entry(const QFileInfo &binary)
+{
+    auto it = records_.find(binary.absoluteFilePath());
+    if (it == records_.end())
+        return {};
+
+    auto &record = it->second;
+    if (record.size != binary.size() || record.mtime != binary.lastModified().toMSecsSinceEpoch())
+        return {};
+
+    record.used = true;
+    return record.entry;
+}
+
+void PluginMetaDataCache::insert(const QFileInfo &binary, Entry entry)
+{
+    records_.insert_or_assign(binary.absoluteFilePath(),
+                              Record{binary.size(), binary.lastModified().toMSecsSinceEpoch(),
+                                     ::move(entry), true});
+    modified_ = true;
+}
+
+bool PluginMetaDataCache::load()
+{
+    QFile file(path_);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    // Validation results depend on the app version
+    QDataStream stream(&file);
+    quint32 magic, version, count;
+    QString app_version;
+    stream >> magic >> version >> app_version >> count;
+    if (stream.status() != QDataStream::Ok || magic != CACHE_MAGIC || version != CACHE_VERSION
+        || app_version != QString(ALBERT_VERSION_STRING))
+        return false;
+
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString path;
+        Record record;
+        stream >> path >> record.size >> record.mtime >> record.entry.error >> record.entry.metadata;
+        records_.emplace(::move(path), ::move(record));
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+bool PluginMetaDataCache::save()
+{
+    // Drop the entries of removed binaries
+    quint32 count = 0;
+    for (const auto &[path, record] : records_)
+        if (record.used)
+            ++count;
+
+    // Atomically replaces the file on commit
+    QSaveFile file(path_);
+    if (!file.open(QIODevice::WriteOnly)) {
+        WARN << "Failed to write the plugin metadata cache" << path_;
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream << CACHE_MAGIC << CACHE_VERSION << QString(ALBERT_VERSION_STRING) << count;
+    for (const auto &[path, record] : records_)
+        if (record.used)
+            stream << path << record.size << record.mtime << record.entry.error << record.entry.metadata;
+
+    if (stream.status() != QDataStream::Ok || !file.commit()) {
+        WARN << "Failed to write the plugin metadata cache" << path_;
+        return false;
+    }
+    modified_ = false;
+    return true;
+}
@@ -0,0 +1,41 @@
+// Copyright (c) 2023 Manuel Schneider
+
+#pragma once
+#include "albert/extension/pluginprovider/pluginmetadata.h"
+#include <QString>
+#include <map>
+#include <optional>
+class QFileInfo;
+
+/// Persistent cache of the metadata of plugin binaries.
+/// Entries are valid as long as path, size and modification time of the
+/// binary did not change. Entries of binaries not looked up are dropped on save.
+class PluginMetaDataCache
+{
+public:
+    struct Entry {
+        albert::PluginMetaData metadata;
+        QString error;  ///< The validation result, null if valid
+    };
+
+    explicit PluginMetaDataCache(const QString &path);
+    ~PluginMetaDataCache();  ///< Saves if modified or binaries disappeared
+
+    std::optional<Entry> entry(const QFileInfo &binary);
+    void insert(const QFileInfo &binary, Entry entry);
+    bool save();
+
+private:
+    struct Record {
+        qint64 size;
+        qint64 mtime;
+        Entry entry;
+        bool used = false;
+    };
+
+    bool load();
+
+    const QString path_;
+    std::map<QString, Record> records_;  // Path > record
+    bool modified_ = false;
+};
@@ -45,6 +45,8 @@ public:
             state = "Loaded";
         else if (loader_.stateInfo().isEmpty())
             state = "Unloaded";
+        else if (plugin_registry_.isLazy(id()))
+            state = loader_.stateInfo();
         else
             state = QString("ERROR: %1").arg(loader_.stateInfo());
 
@@ -1,23 +1,40 @@
 // Copyright (c) 2023 Manuel Schneider
 
 #include "albert/albert.h"
+#include "albert/extension/frontend/frontend.h"
+#include "albert/extension/pluginprovider/plugininstance.h"
 #include "albert/extension/pluginprovider/pluginloader.h"
 #include "albert/extension/pluginprovider/pluginmetadata.h"
 #include "albert/extension/pluginprovider/pluginprovider.h"
+#include "albert/extension/queryhandler/fallbackprovider.h"
+#include "albert/extension/queryhandler/globalqueryhandler.h"
 #include "albert/logging.h"
+#include "lazytriggerqueryhandler.h"
 #include "pluginloaderprivate.h"
 #include "pluginregistry.h"
 #include <QApplication>
+#include <QDateTime>
+#include <QFileInfo>
 #include <QMessageBox>
 #include <QSettings>
+#include <QtConcurrent>
+#include <set>
 using namespace albert;
 using namespace std;
 
+static const char *CFG_LAZY_LOADING = "lazyPluginLoading";
+static const bool  CFG_LAZY_LOADING_DEF = false;
+static const char *STATE_LAZY_PLUGINS = "lazy_plugins";
 
 PluginRegistry::PluginRegistry(ExtensionRegistry &registry)
     : albert::ExtensionWatcher<PluginProvider>(&registry), extension_registry(registry) {}
 
-PluginRegistry::~PluginRegistry() = default; // private PluginLoader dtor
+PluginRegistry::~PluginRegistry()
+{
+    waitForLoads();  // private PluginLoader dtor
+    while (!lazy_handlers_.empty())
+        dropLazyHandlers(QString(lazy_handlers_.begin()->first));
+}
 
 const map<QString, PluginLoader*> &PluginRegistry::plugins() const { return registered_plugins_; }
 
@@ -31,10 +48,13 @@ void PluginRegistry::enable(const QString &id, bool enable)
         albert::settings()->setValue(QString("%1/enabled").arg(id), enable);
         emit enabledChanged(id);
 
-        if (enable && loader->state() == PluginState::Unloaded ){
-            if (auto err = loader->d->load(&extension_registry); !err.isNull())
-                GWARN(QString("Failed loading plugin '%1': %2").arg(id, err));
-        } else if (!enable && loader->state() == PluginState::Loaded){
+        if (!enable && lazy_handlers_.contains(id))
+            dropLazyHandlers(id);
+        else if (enable && lazy_handlers_.contains(id))
+            activate(id);
+        else if (enable && loader->state() == PluginState::Unloaded )
+            scheduleLoads({loader});
+        else if (!enable && loader->state() == PluginState::Loaded){
             switch (loader->metaData().load_type) {
 
             case albert::LoadType::User:
@@ -69,9 +89,15 @@ void PluginRegistry::load(const QString &id, bool load)
 {
     try {
         auto *loader = registered_plugins_.at(id);
-        if (load){
+        if (lazy_handlers_.contains(id)){
+            if (load)
+                activate(id);
+            else
+                dropLazyHandlers(id);
+        } else if (load){
             if (auto err = loader->d->load(&extension_registry); !err.isNull())
                 GWARN(QString("Failed loading plugin '%1': %2").arg(id, err));
+            recordLazyHandlers(loader);
         } else {
             if (auto err = loader->d->unload(&extension_registry); !err.isNull())
                 GWARN(QString("Failed unloading plugin '%1': %2").arg(id, err));
@@ -81,10 +107,162 @@ void PluginRegistry::load(const QString &id, bool load)
     }
 }
 
+optional<chrono::milliseconds> PluginRegistry::loadDuration(const QString &id) const
+{
+    if (auto it = registered_plugins_.find(id);
+            it != registered_plugins_.end() && it->second->state() == PluginState::Loaded)
+        return chrono::duration_cast<chrono::milliseconds>(it->second->d->load_duration);
+    return {};
+}
+
+bool PluginRegistry::lazyLoading() const
+{ return settings()->value(CFG_LAZY_LOADING, CFG_LAZY_LOADING_DEF).toBool(); }
+
+void PluginRegistry::setLazyLoading(bool value)
+{
+    settings()->setValue(CFG_LAZY_LOADING, value);
+    if (value)
+        for (const auto &[id, loader] : registered_plugins_)
+            recordLazyHandlers(loader);
+    else
+        state()->remove(STATE_LAZY_PLUGINS);
+}
+
+void PluginRegistry::recordLazyHandlers(const PluginLoader *loader) const
+{
+    if (!lazyLoading())
+        return;
+
+    const auto &id = loader->metaData().id;
+    auto s = state();
+    s->beginGroup(STATE_LAZY_PLUGINS);
+    s->remove(id);
+
+    if (loader->state() != PluginState::Loaded || loader->metaData().load_type != LoadType::User)
+        return;
+
+    // Triggered query handlers only, the others are needed before the first use
+    vector<TriggerQueryHandler*> handlers;
+    for (auto *e : loader->instance()->extensions()){
+        auto *handler = dynamic_cast<TriggerQueryHandler*>(e);
+        if (!handler || dynamic_cast<GlobalQueryHandler*>(e) || dynamic_cast<FallbackHandler*>(e)
+            || dynamic_cast<PluginProvider*>(e) || dynamic_cast<Frontend*>(e))
+            return;
+        handlers.emplace_back(handler);
+    }
+    if (handlers.empty())
+        return;
+
+    s->beginGroup(id);
+    s->setValue("version", loader->metaData().version);
+    s->setValue("path", loader->path);
+    s->setValue("modified", QFileInfo(loader->path).lastModified().toMSecsSinceEpoch());
+    s->beginWriteArray("handlers", (int)handlers.size());
+    for (int i = 0; i < (int)handlers.size(); ++i){
+        const auto *h = handlers[i];
+        s->setArrayIndex(i);
+        s->setValue("id", h->id());
+        s->setValue("name", h->name());
+        s->setValue("description", h->description());
+        s->setValue("synopsis", h->synopsis());
+        s->setValue("default_trigger", h->defaultTrigger());
+        s->setValue("allow_trigger_remap", h->allowTriggerRemap());
+        s->setValue("supports_fuzzy_matching", h->supportsFuzzyMatching());
+    }
+    s->endArray();
+}
+
+bool PluginRegistry::registerLazyHandlers(PluginLoader *loader)
+{
+    const auto id = loader->metaData().id;
+    auto s = state();
+    s->beginGroup(QString("%1/%2").arg(STATE_LAZY_PLUGINS, id));
+
+    // The handlers may have changed with the binary
+    if (s->value("version").toString() != loader->metaData().version
+        || s->value("path").toString() != loader->path
+        || s->value("modified").toLongLong() != QFileInfo(loader->path).lastModified().toMSecsSinceEpoch())
+        return false;
+
+    vector<unique_ptr<LazyTriggerQueryHandler>> handlers;
+    auto count = s->beginReadArray("handlers");
+    for (int i = 0; i < count; ++i){
+        s->setArrayIndex(i);
+        handlers.emplace_back(make_unique<LazyTriggerQueryHandler>(
+            LazyTriggerQueryHandler::Properties{
+                s->value("id").toString(),
+                s->value("name").toString(),
+                s->value("description").toString(),
+                s->value("synopsis").toString(),
+                s->value("default_trigger").toString(),
+                s->value("allow_trigger_remap").toBool(),
+                s->value("supports_fuzzy_matching").toBool()
+            },
+            this, [this, id]{ activate(id); }));
+    }
+    s->endArray();
+
+    if (handlers.empty())
+        return false;
+
+    for (auto &handler : handlers)
+        extension_registry.add(handler.get());
+    lazy_handlers_.emplace(id, ::move(handlers));
+    loader->d->setState(PluginState::Unloaded, QStringLiteral("Loads on first use."));  // Replaced by load
+    DEBG << "Plugin" << id << "loads on first use";
+    return true;
+}
+
+void PluginRegistry::activate(const QString &id)
+{
+    auto it = lazy_handlers_.find(id);
+    if (it == lazy_handlers_.end())
+        return;  // Activated or dropped meanwhile
+
+    auto handlers = ::move(it->second);
+    lazy_handlers_.erase(it);
+    for (auto &handler : handlers)
+        extension_registry.remove(handler.get());
+
+    auto *loader = registered_plugins_.at(id);
+    if (auto err = loader->d->load(&extension_registry); !err.isNull())
+        GWARN(QString("Failed loading plugin '%1': %2").arg(id, err));
+    recordLazyHandlers(loader);
+
+    // Forward the waiting queries. Queries may still hold the proxies.
+    for (auto &handler : handlers){
+        TriggerQueryHandler *real_handler = nullptr;
+        if (loader->state() == PluginState::Loaded)
+            for (auto *e : loader->instance()->extensions())
+                if (e->id() == handler->id())
+                    real_handler = dynamic_cast<TriggerQueryHandler*>(e);
+        handler->setHandler(real_handler);
+        retired_lazy_handlers_.emplace_back(::move(handler));
+    }
+}
+
+void PluginRegistry::dropLazyHandlers(const QString &id)
+{
+    if (auto it = lazy_handlers_.find(id); it != lazy_handlers_.end()){
+        auto handlers = ::move(it->second);
+        lazy_handlers_.erase(it);
+        for (auto &handler : handlers){
+            extension_registry.remove(handler.get());
+            handler->setHandler(nullptr);
+            retired_lazy_handlers_.emplace_back(::move(handler));
+        }
+        if (auto loader = registered_plugins_.find(id); loader != registered_plugins_.end())
+            loader->second->d->setState(PluginState::Unloaded);
+    }
+}
+
+bool PluginRegistry::isLazy(const QString &id) const { return lazy_handlers_.contains(id); }
+
 void PluginRegistry::onAdd(PluginProvider *pp)
 {
     const auto &plugins = plugins_.emplace(pp, pp->plugins()).first->second;
 
+    vector<PluginLoader*> enabled_plugins;
     for (auto &loader : plugins){
         auto id = loader->metaData().id;
 
@@ -95,21 +273,136 @@ void PluginRegistry::onAdd(PluginProvider *pp)
             if (isEnabled(id)
                 && (loader->metaData().load_type ==  LoadType::User
                     || loader->metaData().load_type ==  LoadType::NoUnload))
-                load(id);
+                enabled_plugins.emplace_back(loader);
 
         } else
             INFO << "Plugin" << id << "shadowed:" << loader->path;
     }
 
+    // Defer plugins that neither have nor are dependencies of enabled plugins
+    if (lazyLoading()){
+        set<QString> dependencies;
+        for (const auto &[id, loader] : registered_plugins_)
+            if (isEnabled(id))
+                for (const auto &dependency : loader->metaData().plugin_dependencies)
+                    dependencies.insert(dependency);
+
+        erase_if(enabled_plugins, [&](PluginLoader *loader){
+            return loader->metaData().load_type == LoadType::User
+                   && loader->metaData().plugin_dependencies.isEmpty()
+                   && !dependencies.contains(loader->metaData().id)
+                   && registerLazyHandlers(loader);
+        });
+    }
+
+    scheduleLoads(::move(enabled_plugins));
+
     emit pluginsChanged();
 }
 
+void PluginRegistry::scheduleLoads(vector<PluginLoader*> loaders)
+{
+    for (auto *loader : loaders)
+        for (const auto &dependency : loader->metaData().plugin_dependencies)
+            activate(dependency);
+
+    for (auto *loader : loaders)
+        if (loader->state() == PluginState::Unloaded){
+            loader->d->setState(PluginState::Busy, QStringLiteral("Waiting for dependencies…"));
+            pending_loads_.emplace_back(loader);
+        }
+    startLoads();
+}
+
+QString PluginRegistry::missingDependency(const PluginLoader *loader) const
+{
+    for (const auto &id : loader->metaData().plugin_dependencies)
+        if (auto it = registered_plugins_.find(id);
+                it == registered_plugins_.end() || it->second->state() == PluginState::Unloaded)
+            return id;
+    return {};
+}
+
+void PluginRegistry::startLoads()
+{
+    // Start every plugin whose dependencies are loaded until nothing changes.
+    // Rescan after every change, plugins loading in this thread may process events.
+    for (bool progress = true; progress;){
+        progress = false;
+        for (auto it = pending_loads_.begin(); it != pending_loads_.end(); ++it){
+            auto *loader = *it;
+            const auto &dependencies = loader->metaData().plugin_dependencies;
+
+            if (auto id = missingDependency(loader); !id.isNull()){
+                pending_loads_.erase(it);
+                loader->d->setState(PluginState::Unloaded, QString("Required plugin not loaded: '%1'").arg(id));
+                GWARN(QString("Failed loading plugin '%1': %2").arg(loader->metaData().id, loader->stateInfo()));
+                progress = true;
+                break;
+
+            } else if (all_of(dependencies.begin(), dependencies.end(), [this](const QString &dependency){
+                           return registered_plugins_.at(dependency)->state() == PluginState::Loaded; })){
+                pending_loads_.erase(it);
+                startLoad(loader);
+                progress = true;
+                break;
+            }
+        }
+    }
+
+    // Nothing loading but still waiting, i.e. cyclic dependencies
+    if (running_load_count_ == 0)
+        for (auto *loader : exchange(pending_loads_, {})){
+            loader->d->setState(PluginState::Unloaded, QStringLiteral("Cyclic plugin dependencies."));
+            GWARN(QString("Failed loading plugin '%1': %2").arg(loader->metaData().id, loader->stateInfo()));
+        }
+}
+
+void PluginRegistry::startLoad(PluginLoader *loader)
+{
+    loader->d->setState(PluginState::Busy, QStringLiteral("Loading…"));
+    ++running_load_count_;
+
+    auto finish = [this, loader](const QStringList &errors){
+        if (--running_load_count_ == 0)
+            running_loads_.clearFutures();  // Do not keep the finished futures until waitForLoads
+        if (auto err = loader->d->finishLoad(&extension_registry, errors); !err.isNull())
+            GWARN(QString("Failed loading plugin '%1': %2").arg(loader->metaData().id, err));
+        recordLazyHandlers(loader);
+        startLoads();
+    };
+
+    if (loader->metaData().thread_safe)
+        running_loads_.addFuture(QtConcurrent::run([this, loader, finish]{
+            auto errors = loader->d->loadInstance(&extension_registry);
+            QMetaObject::invokeMethod(this, [finish, errors]{ finish(errors); }, Qt::QueuedConnection);
+        }));
+    else
+        finish(loader->d->loadInstance(&extension_registry));
+}
+
+void PluginRegistry::waitForLoads()
+{
+    for (auto *loader : exchange(pending_loads_, {}))
+        loader->d->setState(PluginState::Unloaded);
+
+    // Finish the loads in the pool, their completion is queued in this thread
+    while (running_load_count_ > 0){
+        running_loads_.waitForFinished();
+        QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
+    }
+    running_loads_.clearFutures();
+}
+
 void PluginRegistry::onRem(PluginProvider *pp)
 {
+    waitForLoads();
+
     for (auto it = registered_plugins_.begin(); it != registered_plugins_.end();){
         const auto &[id, loader] = *it;
 
         if (&loader->provider() == pp){
+            dropLazyHandlers(id);
             if (loader->state() == PluginState::Loaded)
                 load(id, false);
             it = registered_plugins_.erase(it);
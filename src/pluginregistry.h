@@ -3,9 +3,14 @@
 #pragma once
 #include "albert/extensionregistry.h"
 #include "albert/extensionwatcher.h"
+#include <QFutureSynchronizer>
 #include <QObject>
+#include <chrono>
 #include <map>
+#include <memory>
+#include <optional>
 #include <vector>
+class LazyTriggerQueryHandler;
 namespace albert {
 class PluginProvider;
 class PluginLoader;
@@ -24,6 +29,17 @@ public:
     void enable(const QString &id, bool enable = true);
     void load(const QString &id, bool load = true);
 
+    /// The duration of the latest load of the plugin, if it is loaded.
+    std::optional<std::chrono::milliseconds> loadDuration(const QString &id) const;
+
+    /// Load plugins providing triggered query handlers only on first use.
+    /// Takes effect on the next start.
+    bool lazyLoading() const;
+    void setLazyLoading(bool);
+
+    /// Whether the plugin is deferred until its handlers get used.
+    bool isLazy(const QString &id) const;
+
     albert::ExtensionRegistry &extension_registry;
 
 protected:
@@ -31,8 +47,28 @@ protected:
     void onRem(albert::PluginProvider*) override;
 
 private:
+    // Loads the given plugins as soon as their dependencies are loaded.
+    // Thread safe plugins load in the thread pool, the others in this thread.
+    void scheduleLoads(std::vector<albert::PluginLoader*> loaders);
+    void startLoads();
+    void startLoad(albert::PluginLoader *loader);
+    QString missingDependency(const albert::PluginLoader *loader) const;
+    void waitForLoads();
+
+    // Lazy loading. Plugins are eligible if they were loaded before, provide
+    // triggered query handlers only and no plugin depends on them.
+    void recordLazyHandlers(const albert::PluginLoader *loader) const;
+    bool registerLazyHandlers(albert::PluginLoader *loader);
+    void activate(const QString &id);
+    void dropLazyHandlers(const QString &id);
+
     std::map<QString, albert::PluginLoader*> registered_plugins_;
     std::map<albert::PluginProvider*, std::vector<albert::PluginLoader*>> plugins_;
+    std::vector<albert::PluginLoader*> pending_loads_;  // Waiting for dependencies
+    QFutureSynchronizer<void> running_loads_;
+    uint running_load_count_ = 0;
+    std::map<QString, std::vector<std::unique_ptr<LazyTriggerQueryHandler>>> lazy_handlers_;
+    std::vector<std::unique_ptr<LazyTriggerQueryHandler>> retired_lazy_handlers_;  // May still be in use
 
 signals:
     void enabledChanged(const QString &id);
@@ -11,37 +11,46 @@ using namespace std;
 using namespace albert;
 
 
-QtPluginLoader::QtPluginLoader(const QtPluginProvider &provider, const QString &p)
-    : PluginLoader(p), loader(p), provider_(provider)
+QtPluginLoader::QtPluginLoader(const QtPluginProvider &provider, const QString &p, PluginMetaData metadata)
+    : PluginLoader(p), loader(p), provider_(provider), metadata_(::move(metadata))
 {
     // Some python libs do not link against python. Export the python symbols to the main app.
     loader.setLoadHints(QLibrary::ExportExternalSymbolsHint);// | QLibrary::PreventUnloadHint);
+}
+
+PluginMetaData QtPluginLoader::readMetaData(const QString &path)
+{
+    PluginMetaData metadata;
 
-    // Extract metadata
+    // Extract metadata. QPluginLoader::metaData() builds the json on every call.
 
-    metadata_.iid = loader.metaData()["IID"].toString();
-    if (metadata_.iid.isEmpty())
+    const auto metadata_json = QPluginLoader(path).metaData();
+
+    metadata.iid = metadata_json["IID"].toString();
+    if (metadata.iid.isEmpty())
         throw runtime_error("Not an albert plugin");
 
-    auto rawMetadata = loader.metaData()["MetaData"].toObject();
-    metadata_.id = rawMetadata["id"].toString();
-    metadata_.version = rawMetadata["version"].toString();
-    metadata_.name = rawMetadata["name"].toString();
-    metadata_.description = rawMetadata["description"].toString();
-    metadata_.long_description = rawMetadata["long_description"].toString();
-    metadata_.license = rawMetadata["license"].toString();
-    metadata_.url = rawMetadata["url"].toString();
-    metadata_.maintainers = rawMetadata["maintainers"].toVariant().toStringList();
-    metadata_.runtime_dependencies = rawMetadata["runtime_dependencies"].toVariant().toStringList();
-    metadata_.binary_dependencies = rawMetadata["binary_dependencies"].toVariant().toStringList();
-    metadata_.third_party_credits = rawMetadata["credits"].toVariant().toStringList();
+    auto rawMetadata = metadata_json["MetaData"].toObject();
+    metadata.id = rawMetadata["id"].toString();
+    metadata.version = rawMetadata["version"].toString();
+    metadata.name = rawMetadata["name"].toString();
+    metadata.description = rawMetadata["description"].toString();
+    metadata.long_description = rawMetadata["long_description"].toString();
+    metadata.license = rawMetadata["license"].toString();
+    metadata.url = rawMetadata["url"].toString();
+    metadata.maintainers = rawMetadata["maintainers"].toVariant().toStringList();
+    metadata.runtime_dependencies = rawMetadata["runtime_dependencies"].toVariant().toStringList();
+    metadata.binary_dependencies = rawMetadata["binary_dependencies"].toVariant().toStringList();
+    metadata.third_party_credits = rawMetadata["credits"].toVariant().toStringList();
+    metadata.plugin_dependencies = rawMetadata["plugin_dependencies"].toVariant().toStringList();
+    metadata.thread_safe = rawMetadata["thread_safe"].toBool();
 
     if (auto lt = rawMetadata["loadtype"].toString(); lt == "frontend")
-        metadata_.load_type = LoadType::Frontend;
+        metadata.load_type = LoadType::Frontend;
     else if(lt == "nounload")
-        metadata_.load_type = LoadType::NoUnload;
+        metadata.load_type = LoadType::NoUnload;
     else  // "user
-        metadata_.load_type = LoadType::User;
+        metadata.load_type = LoadType::User;
 
 
     // Validate metadata
@@ -49,7 +58,7 @@ QtPluginLoader::QtPluginLoader(const QtPluginProvider &provider, const QString &
     QStringList errors;
 
     static const auto regex_iid = QRegularExpression(R"R(org.albert.PluginInterface/(\d+).(\d+))R");
-    if (auto iid_match = regex_iid.match(metadata_.iid); !iid_match.hasMatch())
+    if (auto iid_match = regex_iid.match(metadata.iid); !iid_match.hasMatch())
         errors << QString("Invalid IID pattern: '%1'. Expected '%2'.")
                       .arg(iid_match.captured(), iid_match.regularExpression().pattern());
     else if (auto plugin_iid_major = iid_match.captured(1).toUInt(); plugin_iid_major != ALBERT_VERSION_MAJOR)
@@ -60,21 +69,23 @@ QtPluginLoader::QtPluginLoader(const QtPluginProvider &provider, const QString &
                       .arg(plugin_iid_minor).arg(ALBERT_VERSION_MINOR);
 
     static const auto regex_version = QRegularExpression(R"(^\d+\.\d+$)");
-    if (!regex_version.match(metadata_.version).hasMatch())
+    if (!regex_version.match(metadata.version).hasMatch())
         errors << "Invalid version scheme. Use '<version>.<patch>'.";
 
     static const auto regex_id = QRegularExpression("[a-z0-9_]");
-    if (!regex_id.match(metadata_.id).hasMatch())
+    if (!regex_id.match(metadata.id).hasMatch())
         errors << "Invalid plugin id. Use [a-z0-9_].";
 
-    if (metadata_.name.isEmpty())
+    if (metadata.name.isEmpty())
         errors << "'name' must not be empty.";
 
-    if (metadata_.description.isEmpty())
+    if (metadata.description.isEmpty())
         errors << "'description' must not be empty.";
 
     if (!errors.isEmpty())
         throw std::runtime_error(errors.join(", ").toUtf8().constData());
+
+    return metadata;
 }
 
 QtPluginLoader::~QtPluginLoader()
@@ -17,9 +17,13 @@ class QtPluginProvider;
 class QtPluginLoader : public albert::PluginLoader
 {
 public:
-    QtPluginLoader(const QtPluginProvider &provider, const QString &path);
+    QtPluginLoader(const QtPluginProvider &provider, const QString &path, albert::PluginMetaData metadata);
     ~QtPluginLoader();
 
+    // Reads and validates the metadata of the plugin at path. Throws
+    // runtime_error if the file is not a valid albert plugin. Thread safe.
+    static albert::PluginMetaData readMetaData(const QString &path);
+
     const albert::PluginProvider &provider() const override;
     const albert::PluginMetaData &metaData() const override;
 
@@ -33,7 +37,7 @@ public:
 private:
     QPluginLoader loader;
     const QtPluginProvider &provider_;
-    albert::PluginInstance *instance_;
+    albert::PluginInstance *instance_ = nullptr;
     albert::PluginMetaData metadata_;
 };
 
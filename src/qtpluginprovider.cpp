@@ -1,13 +1,18 @@
 // Copyright (c) 2022-2023 Manuel Schneider
 
+#include "albert/albert.h"
 #include "albert/logging.h"
+#include "albert/util/timeprinter.h"
+#include "pluginmetadatacache.h"
 #include "qtpluginloader.h"
 #include "qtpluginprovider.h"
 #include <QDirIterator>
 #include <QMessageBox>
 #include <QSettings>
+#include <QtConcurrent>
 using namespace std;
 using namespace albert;
+static const char *METADATA_CACHE_FILE_NAME = "pluginmetadata.cache";
 
 #if defined __linux__ || defined __FreeBSD__
 static QStringList defaultPaths()
@@ -45,18 +50,51 @@ QtPluginProvider::QtPluginProvider(QStringList additional_paths):
 {
     /// Lookup is fast and frontend needed before the registry calls
     /// plugins(), therefore lookup actually happens in ctor
+    TimePrinter tp_total("[%1 ms] spent discovering native plugins");
+    TimePrinter tp("[%1 ms] spent scanning the plugin directories");
+
+    vector<QFileInfo> files;
     for (const auto &path : paths_) {
         DEBG << "Searching native plugins in" << path;
         QDirIterator dirIterator(path, QDir::Files);
-        while (dirIterator.hasNext()) {
-            try {
-                auto loader = make_unique<QtPluginLoader>(*this, QFileInfo(dirIterator.next()).absoluteFilePath());
-                DEBG << "Found valid native plugin" << loader->path;
-                plugins_.push_back(::move(loader));
-            } catch (const runtime_error &e) {
-                DEBG << e.what() << dirIterator.filePath();
-            }
+        while (dirIterator.hasNext())
+            files.emplace_back(QFileInfo(dirIterator.next()).absoluteFilePath());
+    }
+
+    tp.restart("[%1 ms] spent reading the plugin metadata");
+
+    // Unchanged binaries are not parsed at all
+    PluginMetaDataCache cache(QDir(cacheLocation()).filePath(METADATA_CACHE_FILE_NAME));
+    vector<PluginMetaDataCache::Entry> entries(files.size());
+    vector<size_t> misses;
+    for (size_t i = 0; i < files.size(); ++i)
+        if (auto entry = cache.entry(files[i]))
+            entries[i] = ::move(*entry);
+        else
+            misses.emplace_back(i);
+    DEBG << QString("Reading the metadata of %1 of %2 files").arg(misses.size()).arg(files.size());
+
+    // Parsing the binaries is the expensive part, do it in parallel.
+    // The loaders are QObjects though and have to live in this thread.
+    QtConcurrent::blockingMap(misses, [&](size_t i){
+        try {
+            entries[i].metadata = QtPluginLoader::readMetaData(files[i].absoluteFilePath());
+        } catch (const runtime_error &e) {
+            entries[i].error = e.what();
         }
+    });
+    for (size_t i : misses)
+        cache.insert(files[i], entries[i]);
+
+    tp.restart("[%1 ms] spent creating the plugin loaders");
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        const auto path = files[i].absoluteFilePath();
+        if (auto &entry = entries[i]; entry.error.isNull()) {
+            DEBG << "Found valid native plugin" << path;
+            plugins_.emplace_back(make_unique<QtPluginLoader>(*this, path, ::move(entry.metadata)));
+        } else
+            DEBG << entry.error << path;
     }
 }
 
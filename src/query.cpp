@@ -5,11 +5,16 @@
 #include "albert/util/timeprinter.h"
 #include "query.h"
 #include "usagedatabase.h"
+#include <QTimer>
 #include <QtConcurrent>
+#include <condition_variable>
 using namespace std;
 using namespace albert;
 
 uint QueryBase::query_count = 0;
+atomic<uint> QueryBase::destruction_wait_count = 0;
+atomic<int64_t> QueryBase::destruction_wait_total_ms = 0;
+atomic<int64_t> QueryBase::destruction_wait_max_ms = 0;
 
 QueryBase::QueryBase(vector<FallbackHandler*> fallback_handlers, QString string):
     fallback_handlers_(::move(fallback_handlers)),
@@ -21,6 +26,16 @@ QueryBase::QueryBase(vector<FallbackHandler*> fallback_handlers, QString string)
     connect(&future_watcher_, &decltype(future_watcher_)::finished, this, &QueryBase::finished);
 }
 
+void QueryBase::setDeadline(chrono::milliseconds deadline) { deadline_ = deadline; }
+
+void QueryBase::setPrefetchWindow(uint rows)
+{
+    matches_.setPrefetchWindow(rows);
+    fallbacks_.setPrefetchWindow(rows);
+}
+
+void QueryBase::setVirtualized(bool value) { matches_.setVirtualized(value); }
+
 void QueryBase::run()
 {
     future_watcher_.setFuture(QtConcurrent::run([this](){
@@ -31,9 +46,49 @@ void QueryBase::run()
             WARN << "Handler thread threw" << e.what();
         }
     }));
+
+    if (deadline_.count() > 0)
+        QTimer::singleShot(deadline_, this, [this]{
+            if (!isFinished()){
+                INFO << QString("Query exceeded deadline of %1 ms, cancelling. [#%2 '%3']")
+                            .arg(deadline_.count()).arg(query_id).arg(string_);
+                cancel();
+            }
+        });
+}
+
+void QueryBase::cancel()
+{
+    cancelled_.store(true, memory_order_release);
+    valid_ = false;
 }
 
-void QueryBase::cancel() { valid_ = false; }
+bool QueryBase::isCancelled() const { return cancelled_.load(memory_order_acquire); }
+
+void QueryBase::waitForFinished()
+{
+    if (future_watcher_.isFinished())
+        return;
+
+    WARN << QString("Busy wait on query: #%1").arg(query_id);
+    const auto start = chrono::steady_clock::now();
+    future_watcher_.waitForFinished();
+    const auto ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+
+    ++destruction_wait_count;
+    destruction_wait_total_ms += ms;
+    for (auto max = destruction_wait_max_ms.load(); ms > max
+         && !destruction_wait_max_ms.compare_exchange_weak(max, ms););
+
+    WARN << QString("Busy waited %1 ms on query: #%2").arg(ms).arg(query_id);
+}
+
+QueryBase::DestructionWaitStats QueryBase::destructionWaitStats()
+{
+    return {destruction_wait_count.load(),
+            chrono::milliseconds(destruction_wait_total_ms.load()),
+            chrono::milliseconds(destruction_wait_max_ms.load())};
+}
 
 bool QueryBase::isFinished() const { return future_watcher_.isFinished(); }
 
@@ -77,10 +132,7 @@ TriggerQuery::TriggerQuery(std::vector<FallbackHandler *> &&fallback_handlers,
 TriggerQuery::~TriggerQuery()
 {
     // Avoid segfaults when handler write on a deleted query
-    if (!future_watcher_.isFinished()) {
-        WARN << QString("Busy wait on query: #%1").arg(query_id);
-        future_watcher_.waitForFinished();
-    }
+    waitForFinished();
     DEBG << QString("Query deleted. [#%1 '%2']").arg(query_id).arg(string_);
 }
 
@@ -102,33 +154,36 @@ void TriggerQuery::add(vector<shared_ptr<Item>> &&items) { matches_.add(query_ha
 
 void TriggerQuery::run_()
 {
-    future_watcher_.setFuture(QtConcurrent::run([this](){
-        TimePrinter<std::chrono::microseconds> tp(QString("TIME: %1 µs ['%2':'%3']").arg("%1", query_handler_->id(), string_));
-        try {
-            query_handler_->handleTriggerQuery(this);
-        } catch (const exception &e){
-            WARN << "Handler thread threw" << e.what();
-        }
-    }));
+    // Already on a pool thread. Run synchronously such that the future
+    // watched by future_watcher_ covers the handler.
+    if (isCancelled())
+        return;
+    TimePrinter<std::chrono::microseconds> tp(QString("TIME: %1 µs ['%2':'%3']").arg("%1", query_handler_->id(), string_));
+    try {
+        query_handler_->handleTriggerQuery(this);
+    } catch (const exception &e){
+        WARN << "Handler thread threw" << e.what();
+    }
 }
 
 // ////////////////////////////////////////////////////////////////////////////
 
 GlobalQuery::GlobalQuery(vector<FallbackHandler*> &&fallback_handlers,
                          vector<GlobalQueryHandler*> &&query_handlers,
-                         QString string):
+                         QString string,
+                         chrono::milliseconds handler_deadline,
+                         bool append_late_results):
     QueryBase(::move(fallback_handlers), ::move(string)),
-    query_handlers_(::move(query_handlers))
+    query_handlers_(::move(query_handlers)),
+    handler_deadline_(handler_deadline),
+    append_late_results_(append_late_results)
 {
 }
 
 GlobalQuery::~GlobalQuery()
 {
     // Avoid segfaults when handler write on a deleted query
-    if (!future_watcher_.isFinished()) {
-        WARN << QString("Busy wait on query: #%1").arg(query_id);
-        future_watcher_.waitForFinished();
-    }
+    waitForFinished();
     DEBG << QString("Query deleted. [#%1 '%2']").arg(query_id).arg(string_);
 }
 
@@ -142,47 +197,89 @@ const bool &GlobalQuery::isValid() const { return valid_; }
 
 void GlobalQuery::run_()
 {
-    mutex rank_items_mutex;  // 6.4 Still no move semantics in QtConcurrent
-    vector<pair<Extension*,RankItem>> rank_items;
-
-    function<void(GlobalQueryHandler*)> map = [this, &rank_items_mutex, &rank_items](GlobalQueryHandler *handler) {
-        try {
-            TimePrinter<std::chrono::microseconds> tp(QString("TIME: %1 µs [%2:'%3']").arg("%1", handler->id(), string_));
-
-            auto r = handler->handleGlobalQuery(this);
-            if (r.empty())
-                return;
-
-            handler->applyUsageScore(&r);
-
-            unique_lock lock(rank_items_mutex);
-            rank_items.reserve(rank_items.size()+r.size());
+    // Handlers run concurrently. Their results are posted to the thread of
+    // the model as they arrive and merged there, the model is not thread
+    // safe. Results arriving after the deadline are appended or dropped.
+    struct Batch {
+        GlobalQueryHandler *handler;
+        vector<RankItem> rank_items;
+        vector<QString> sort_texts;  // Of the items, fetched here to keep them off the model thread
+        chrono::steady_clock::time_point arrival;
+    };
+    mutex batches_mutex;
+    condition_variable batches_condition;
+    vector<Batch> batches;
+    size_t running = query_handlers_.size();
+
+    const auto start = chrono::steady_clock::now();
+
+    for (auto *handler : query_handlers_)
+        QThreadPool::globalInstance()->start([&, handler]{
+            vector<RankItem> r;
+            vector<QString> t;
+            try {
+                // Handlers queued behind a cancelled query do not start at all
+                if (!isCancelled()) {
+                    TimePrinter<std::chrono::microseconds> tp(QString("TIME: %1 µs [%2:'%3']").arg("%1", handler->id(), string_));
+                    r = handler->handleGlobalQuery(this);
+                    handler->applyUsageScore(&r);
+                    t.reserve(r.size());
+                    for (const auto &rank_item : r)
+                        t.emplace_back(rank_item.item->text());
+                }
+            } catch (const exception &e) {
+                WARN << "Global search:" << handler->id() << "threw" << e.what();
+                r.clear();
+                t.clear();
+            }
+
+            lock_guard lock(batches_mutex);
+            batches.push_back({handler, ::move(r), ::move(t), chrono::steady_clock::now()});
+            --running;
+            batches_condition.notify_one();
+        });
+
+    // Do not occupy a pool thread while waiting for the handlers
+    QThreadPool::globalInstance()->releaseThread();
+
+    unique_lock lock(batches_mutex);
+    for (bool done = false; !done;) {
+        batches_condition.wait(lock, [&]{ return !batches.empty() || running == 0; });
+        auto ready = ::move(batches);
+        batches.clear();
+        done = running == 0;
+        lock.unlock();
+
+        for (auto &[handler, r, t, arrival] : ready) {
+            if (r.empty() || isCancelled())
+                continue;
+
+            vector<pair<Extension*,RankItem>> rank_items;
+            rank_items.reserve(r.size());
             for (auto &rank_item : r)
                 rank_items.emplace_back(handler, ::move(rank_item));
 
-        } catch (const exception &e) {
-            WARN << "Global search:" << handler->id() << "threw" << e.what();
+            // Dropped with the model if the query is deleted meanwhile
+            if (handler_deadline_.count() == 0 || arrival - start <= handler_deadline_)
+                QMetaObject::invokeMethod(&matches_, [this, rank_items = ::move(rank_items), sort_texts = ::move(t)]() mutable {
+                    if (!isCancelled())
+                        matches_.add(::move(rank_items), ::move(sort_texts));
+                }, Qt::QueuedConnection);
+            else {
+                auto latency = chrono::duration_cast<chrono::milliseconds>(arrival - start).count();
+                if (append_late_results_) {
+                    DEBG << QString("Appending late results: %1 ms [%2:'%3']").arg(latency).arg(handler->id(), string_);
+                    QMetaObject::invokeMethod(&matches_, [this, rank_items = ::move(rank_items), sort_texts = ::move(t)]() mutable {
+                        if (!isCancelled())
+                            matches_.append(::move(rank_items), ::move(sort_texts));
+                    }, Qt::QueuedConnection);
+                } else
+                    DEBG << QString("Dropping late results: %1 ms [%2:'%3']").arg(latency).arg(handler->id(), string_);
+            }
         }
-    };
 
-    QtConcurrent::blockingMap(query_handlers_, map);
-
-
-    TimePrinter tp(QString("TIME: %1 ms, Sorting global query '%2' results").arg("%1", string_));
-    sort(rank_items.begin(), rank_items.end(), [](const auto &a, const auto &b){
-        if (a.second.score == b.second.score)
-            return a.second.item->text() > b.second.item->text();
-        else
-            return a.second.score > b.second.score;
-    });
-    tp.restart(QString("TIME: %1 ms, adding global query '%2' results").arg("%1", string_));
-    matches_.add(rank_items.begin(), rank_items.end()); // TODO ranges
-
-//    //    auto it = rank_items.begin();
-//    //    for (uint e = 0; pow(10,e)-1 < (uint)rank_items.size(); ++e){
-//    //        auto begin = rank_items.begin()+(uint)pow(10u,e)-1;
-//    //        auto end = rank_items.begin()+min((uint)pow(10u,e+1)-1, (uint)rank_items.size());
-//    //        sort(begin, end, [](const auto &a, const auto &b){ return a.second.score > b.second.score; });
-//    //         TODO c++20 ranges view
-//    //    }
+        lock.lock();
+    }
+
+    QThreadPool::globalInstance()->reserveThread();
 }
@@ -7,6 +7,8 @@
 #include "albert/extension/queryhandler/fallbackprovider.h"
 #include "itemsmodel.h"
 #include <QFutureWatcher>
+#include <atomic>
+#include <chrono>
 #include <set>
 namespace albert { class Item; }
 
@@ -15,8 +17,18 @@ class QueryBase : public albert::Query
 public:
     explicit QueryBase(std::vector<albert::FallbackHandler*> fallback_handlers, QString string);
 
+    /// Cancels the query if it did not finish within deadline. Zero for none.
+    void setDeadline(std::chrono::milliseconds deadline);
+
+    /// @see ItemsModel::setPrefetchWindow
+    void setPrefetchWindow(uint rows);
+
+    /// @see ItemsModel::setVirtualized
+    void setVirtualized(bool);
+
     void run() override;
     void cancel() override;
+    bool isCancelled() const;  ///< Thread safe
 
     bool isFinished() const override;
     bool isTriggered() const override;
@@ -28,19 +40,38 @@ public:
     void activateMatch(uint item, uint action) override;
     void activateFallback(uint item, uint action) override;
 
+    /// Statistics on queries that had to be waited for on destruction.
+    struct DestructionWaitStats {
+        uint count;  ///< Number of destructions that had to wait
+        std::chrono::milliseconds total;  ///< Accumulated wait time
+        std::chrono::milliseconds max;  ///< Longest single wait
+    };
+    static DestructionWaitStats destructionWaitStats();
+
 protected:
     void runFallbackHandlers();
     virtual void run_() = 0;
 
+    /// Blocks until the handlers are done. Call this in the destructors of
+    /// derived classes, since handlers may still write on the query.
+    void waitForFinished();
+
     std::vector<albert::FallbackHandler*> fallback_handlers_;
     QString string_;
     ItemsModel matches_;
     ItemsModel fallbacks_;
-    bool valid_ = true;
+    std::atomic<bool> cancelled_ = false;  // The cancellation token
+    bool valid_ = true;  // Mirror of the token for the isValid() reference API
+    std::chrono::milliseconds deadline_ = {};
     QFutureWatcher<void> future_watcher_;
 
     uint query_id;
     static uint query_count;
+
+private:
+    static std::atomic<uint> destruction_wait_count;
+    static std::atomic<int64_t> destruction_wait_total_ms;
+    static std::atomic<int64_t> destruction_wait_max_ms;
 };
 
 
@@ -71,10 +102,16 @@ public:
 class GlobalQuery : public QueryBase, public albert::GlobalQueryHandler::GlobalQuery
 {
     std::vector<albert::GlobalQueryHandler*> query_handlers_;
+    std::chrono::milliseconds handler_deadline_;
+    bool append_late_results_;
 public:
+    /// @param handler_deadline Results of handlers taking longer than this are
+    /// appended or dropped, depending on append_late_results. Zero for none.
     GlobalQuery(std::vector<albert::FallbackHandler*> &&fallback_handlers,
                          std::vector<albert::GlobalQueryHandler*> &&query_handlers,
-                         QString string);
+                         QString string,
+                         std::chrono::milliseconds handler_deadline = {},
+                         bool append_late_results = true);
     ~GlobalQuery() override;
 
     void run_() override;
@@ -24,34 +24,105 @@ static const char *CFG_TRIGGER = "trigger";
 static const char *CFG_FUZZY = "fuzzy";
 static const char *CFG_RUN_EMPTY_QUERY = "runEmptyQuery";
 static const bool  CFG_RUN_EMPTY_QUERY_DEF = false;
+static const char *CFG_GLOBAL_HANDLER_DEADLINE = "globalHandlerDeadline";
+static const uint  CFG_GLOBAL_HANDLER_DEADLINE_DEF = 0;
+static const char *CFG_APPEND_LATE_RESULTS = "appendLateResults";
+static const bool  CFG_APPEND_LATE_RESULTS_DEF = true;
+static const char *CFG_QUERY_DEADLINE = "queryDeadline";
+static const uint  CFG_QUERY_DEADLINE_DEF = 0;
+static const char *CFG_PREFETCH_ITEM_DATA = "prefetchItemData";
+static const bool  CFG_PREFETCH_ITEM_DATA_DEF = false;
+static const uint  PREFETCH_WINDOW = 20;
+static const char *CFG_VIRTUALIZE_RESULTS = "virtualizeResults";
+static const bool  CFG_VIRTUALIZE_RESULTS_DEF = false;
 
 QueryEngine::QueryEngine(ExtensionRegistry &registry):
     ExtensionWatcher<TriggerQueryHandler>(&registry),
     ExtensionWatcher<GlobalQueryHandler>(&registry),
     ExtensionWatcher<FallbackHandler>(&registry),
-    registry_(registry)
+    registry_(registry),
+    abandoned_queries_(make_shared<AbandonedQueries>())
 {
     runEmptyQuery_ = settings()->value(CFG_RUN_EMPTY_QUERY, CFG_RUN_EMPTY_QUERY_DEF).toBool();
+    globalHandlerDeadline_ = settings()->value(CFG_GLOBAL_HANDLER_DEADLINE, CFG_GLOBAL_HANDLER_DEADLINE_DEF).toUInt();
+    appendLateResults_ = settings()->value(CFG_APPEND_LATE_RESULTS, CFG_APPEND_LATE_RESULTS_DEF).toBool();
+    queryDeadline_ = settings()->value(CFG_QUERY_DEADLINE, CFG_QUERY_DEADLINE_DEF).toUInt();
+    prefetchItemData_ = settings()->value(CFG_PREFETCH_ITEM_DATA, CFG_PREFETCH_ITEM_DATA_DEF).toBool();
+    virtualizeResults_ = settings()->value(CFG_VIRTUALIZE_RESULTS, CFG_VIRTUALIZE_RESULTS_DEF).toBool();
     UsageHistory::initialize();
 }
 
+QueryEngine::~QueryEngine()
+{
+    waitForAbandonedQueries();
+    UsageHistory::finalize();
+
+    const auto stats = QueryBase::destructionWaitStats();
+    INFO << QString("Queries reaped in background: %1. Destructions that had to wait: %2 "
+                    "(total %3 ms, max %4 ms).")
+                .arg(abandoned_queries_->reaped_count).arg(stats.count)
+                .arg(stats.total.count()).arg(stats.max.count());
+}
+
 shared_ptr<Query> QueryEngine::query(const QString &query_string)
 {
-    shared_ptr<QueryBase> query;
+    QueryBase *query = nullptr;
     vector<FallbackHandler*> fhandlers;
     for (const auto&[id, handler] : enabled_fallback_handlers_)
         fhandlers.emplace_back(handler);
 
     for (const auto &[trigger, handler] : active_triggers_)
-        if (query_string.startsWith(trigger))
-            return query = make_shared<TriggerQuery>(::move(fhandlers), handler, query_string.mid(trigger.size()), trigger);
+        if (query_string.startsWith(trigger)) {
+            query = new TriggerQuery(::move(fhandlers), handler, query_string.mid(trigger.size()), trigger);
+            break;
+        }
 
-    {
+    if (!query) {
         vector<GlobalQueryHandler*> ghandlers;
         for (const auto&[id, handler] : enabled_global_handlers_)
             ghandlers.emplace_back(handler);
-        return query = make_shared<GlobalQuery>(::move(fhandlers), (!query_string.isEmpty() || runEmptyQuery_) ? ::move(ghandlers) : vector<GlobalQueryHandler*>(), query_string);
+        query = new GlobalQuery(::move(fhandlers), (!query_string.isEmpty() || runEmptyQuery_) ? ::move(ghandlers) : vector<GlobalQueryHandler*>(), query_string,
+                                chrono::milliseconds(globalHandlerDeadline_), appendLateResults_);
+    }
+
+    query->setDeadline(chrono::milliseconds(queryDeadline_));
+    query->setPrefetchWindow(prefetchItemData_ ? PREFETCH_WINDOW : 0);
+    query->setVirtualized(virtualizeResults_);
+
+    // Frontends drop queries on every keystroke. Do not let them block on
+    // handlers ignoring isValid(), see release().
+    return shared_ptr<Query>(query, [abandoned = weak_ptr(abandoned_queries_)](QueryBase *q){
+        release(abandoned, q);
+    });
+}
+
+void QueryEngine::release(const weak_ptr<AbandonedQueries> &weak_abandoned, QueryBase *query)
+{
+    query->cancel();
+
+    // Without engine there is nobody to wait for on handler removal
+    auto abandoned = weak_abandoned.lock();
+    if (query->isFinished() || !abandoned) {
+        delete query;
+        return;
     }
+
+    // Detach the query and delete it once the handlers returned. The finished
+    // signal is delivered in the thread of the query, i.e. the GUI thread.
+    abandoned->queries.insert(query);
+    QObject::connect(query, &Query::finished, query, [weak_abandoned, query]{
+        if (auto abandoned_ = weak_abandoned.lock(); abandoned_ && abandoned_->queries.erase(query)) {
+            ++abandoned_->reaped_count;
+            query->deleteLater();
+        }  // Else already deleted by waitForAbandonedQueries()
+    });
+}
+
+void QueryEngine::waitForAbandonedQueries()
+{
+    // Handlers must not be removed while abandoned queries still use them.
+    for (auto *query : exchange(abandoned_queries_->queries, {}))
+        delete query;  // Waits, see QueryBase::waitForFinished()
 }
 
 std::map<QString, TriggerQueryHandler*> QueryEngine::triggerHandlers()
@@ -176,6 +247,36 @@ bool QueryEngine::runEmptyQuery() const
 void QueryEngine::setRunEmptyQuery(bool value)
 { settings()->setValue(CFG_RUN_EMPTY_QUERY, runEmptyQuery_ = value); }
 
+uint QueryEngine::globalHandlerDeadline() const
+{ return globalHandlerDeadline_; }
+
+void QueryEngine::setGlobalHandlerDeadline(uint value)
+{ settings()->setValue(CFG_GLOBAL_HANDLER_DEADLINE, globalHandlerDeadline_ = value); }
+
+bool QueryEngine::appendLateResults() const
+{ return appendLateResults_; }
+
+void QueryEngine::setAppendLateResults(bool value)
+{ settings()->setValue(CFG_APPEND_LATE_RESULTS, appendLateResults_ = value); }
+
+uint QueryEngine::queryDeadline() const
+{ return queryDeadline_; }
+
+void QueryEngine::setQueryDeadline(uint value)
+{ settings()->setValue(CFG_QUERY_DEADLINE, queryDeadline_ = value); }
+
+bool QueryEngine::prefetchItemData() const
+{ return prefetchItemData_; }
+
+void QueryEngine::setPrefetchItemData(bool value)
+{ settings()->setValue(CFG_PREFETCH_ITEM_DATA, prefetchItemData_ = value); }
+
+bool QueryEngine::virtualizeResults() const
+{ return virtualizeResults_; }
+
+void QueryEngine::setVirtualizeResults(bool value)
+{ settings()->setValue(CFG_VIRTUALIZE_RESULTS, virtualizeResults_ = value); }
+
 void QueryEngine::onAdd(TriggerQueryHandler *handler)
 {
     handler->d->trigger = settings()->value(QString("%1/%2").arg(handler->id(), CFG_TRIGGER), handler->defaultTrigger()).toString();
@@ -186,13 +287,34 @@ void QueryEngine::onAdd(TriggerQueryHandler *handler)
 }
 
 void QueryEngine::onAdd(GlobalQueryHandler *handler)
-{ if (isEnabled(handler)) setActive(handler); }
+{
+    if (auto *index_handler = dynamic_cast<IndexQueryHandler*>(handler))
+        index_handler->d->setSnapshotSaving(true);
+    if (isEnabled(handler))
+        setActive(handler);
+}
 
 void QueryEngine::onAdd(FallbackHandler *handler)
 { if (isEnabled(handler)) setActive(handler); }
 
-void QueryEngine::onRem(TriggerQueryHandler *handler) { setActive(handler, false); }
+void QueryEngine::onRem(TriggerQueryHandler *handler)
+{
+    setActive(handler, false);
+    waitForAbandonedQueries();
+}
 
-void QueryEngine::onRem(GlobalQueryHandler *handler) { setActive(handler, false); }
+void QueryEngine::onRem(GlobalQueryHandler *handler)
+{
+    setActive(handler, false);
+    waitForAbandonedQueries();
 
-void QueryEngine::onRem(FallbackHandler *handler) { setActive(handler, false); }
+    // Removed before the plugin gets destroyed, the items are still alive
+    if (auto *index_handler = dynamic_cast<IndexQueryHandler*>(handler))
+        index_handler->d->setSnapshotSaving(false);
+}
+
+void QueryEngine::onRem(FallbackHandler *handler)
+{
+    setActive(handler, false);
+    waitForAbandonedQueries();
+}
@@ -9,6 +9,7 @@
 #include <map>
 #include <memory>
 #include <set>
+class QueryBase;
 
 class QueryEngine:
     public albert::ExtensionWatcher<albert::TriggerQueryHandler>,
@@ -17,7 +18,8 @@ class QueryEngine:
 {
 public:
     explicit QueryEngine(albert::ExtensionRegistry&);
-    
+    ~QueryEngine();
+
     std::shared_ptr<albert::Query> query(const QString &query);
 
     std::map<QString, albert::TriggerQueryHandler*> triggerHandlers();
@@ -48,7 +50,33 @@ public:
     bool runEmptyQuery() const;
     void setRunEmptyQuery(bool);
 
+    uint globalHandlerDeadline() const;  // ms, zero for none
+    void setGlobalHandlerDeadline(uint);
+
+    bool appendLateResults() const;
+    void setAppendLateResults(bool);
+
+    uint queryDeadline() const;  // ms, zero for none
+    void setQueryDeadline(uint);
+
+    bool prefetchItemData() const;
+    void setPrefetchItemData(bool);
+
+    bool virtualizeResults() const;
+    void setVirtualizeResults(bool);
+
 private:
+    // Released but unfinished queries, deleted as soon as their handlers
+    // return. GUI thread only. Referenced weakly by the deleters of the
+    // queries, frontends may hold queries longer than the engine lives.
+    struct AbandonedQueries {
+        std::set<QueryBase*> queries;
+        uint reaped_count = 0;
+    };
+
+    static void release(const std::weak_ptr<AbandonedQueries>&, QueryBase*);
+    void waitForAbandonedQueries();
+
     void onAdd(albert::TriggerQueryHandler*) override;
     void onAdd(albert::GlobalQueryHandler*) override;
     void onAdd(albert::FallbackHandler*) override;
@@ -63,4 +91,10 @@ private:
     albert::ExtensionRegistry &registry_;
     std::map<QString, albert::TriggerQueryHandler*> active_triggers_;
     bool runEmptyQuery_;
+    uint globalHandlerDeadline_;
+    bool appendLateResults_;
+    uint queryDeadline_;
+    bool prefetchItemData_;
+    bool virtualizeResults_;
+    std::shared_ptr<AbandonedQueries> abandoned_queries_;
 };
@@ -266,6 +266,13 @@ void PluginWidget::onUpdatePluginWidget()
         add_meta(QString("Required executable(s) in PATH: %1").arg(p.metaData().binary_dependencies.join(", ")));
     if (!p.metaData().runtime_dependencies.isEmpty())
         add_meta(QString("Required libraries: %1").arg(p.metaData().runtime_dependencies.join(", ")));
+    if (!p.metaData().plugin_dependencies.isEmpty())
+        add_meta(QString("Required plugins: %1").arg(p.metaData().plugin_dependencies.join(", ")));
+
+    // Load time
+    if (auto duration = model_->plugin_registry_.loadDuration(p.metaData().id))
+        add_meta(QString("Loaded in %1 ms%2").arg(duration->count())
+                     .arg(p.metaData().thread_safe ? " (in the background)" : ""));
 
     // Path
     add_meta(p.path);
@@ -150,9 +150,37 @@ void SettingsWindow::init_tab_general_search(App &app)
     QObject::connect(ui.checkBox_prioritizePerfectMatch, &QCheckBox::toggled, this,
                      [](bool val){ UsageHistory::setPrioritizePerfectMatch(val); });
 
+    ui.checkBox_compactActivations->setChecked(UsageHistory::compactActivations());
+    QObject::connect(ui.checkBox_compactActivations, &QCheckBox::toggled, this,
+                     [](bool val){ UsageHistory::setCompactActivations(val); });
+
     ui.checkBox_emptyQuery->setChecked(app.query_engine.runEmptyQuery());
     QObject::connect(ui.checkBox_emptyQuery, &QCheckBox::toggled, this,
                      [&app](bool val){ app.query_engine.setRunEmptyQuery(val); });
+
+    ui.spinBox_handlerDeadline->setValue((int)app.query_engine.globalHandlerDeadline());
+    QObject::connect(ui.spinBox_handlerDeadline, &QSpinBox::valueChanged, this,
+                     [&app](int val){ app.query_engine.setGlobalHandlerDeadline((uint)val); });
+
+    ui.checkBox_appendLateResults->setChecked(app.query_engine.appendLateResults());
+    QObject::connect(ui.checkBox_appendLateResults, &QCheckBox::toggled, this,
+                     [&app](bool val){ app.query_engine.setAppendLateResults(val); });
+
+    ui.spinBox_queryDeadline->setValue((int)app.query_engine.queryDeadline());
+    QObject::connect(ui.spinBox_queryDeadline, &QSpinBox::valueChanged, this,
+                     [&app](int val){ app.query_engine.setQueryDeadline((uint)val); });
+
+    ui.checkBox_prefetchItemData->setChecked(app.query_engine.prefetchItemData());
+    QObject::connect(ui.checkBox_prefetchItemData, &QCheckBox::toggled, this,
+                     [&app](bool val){ app.query_engine.setPrefetchItemData(val); });
+
+    ui.checkBox_virtualizeResults->setChecked(app.query_engine.virtualizeResults());
+    QObject::connect(ui.checkBox_virtualizeResults, &QCheckBox::toggled, this,
+                     [&app](bool val){ app.query_engine.setVirtualizeResults(val); });
+
+    ui.checkBox_lazyPluginLoading->setChecked(app.plugin_registry.lazyLoading());
+    QObject::connect(ui.checkBox_lazyPluginLoading, &QCheckBox::toggled, this,
+                     [&app](bool val){ app.plugin_registry.setLazyLoading(val); });
 }
 
 void SettingsWindow::init_tab_about()
@@ -0,0 +1,135 @@
+// Copyright (c) 2023 Manuel Schneider
+
+#include "tokenizer.h"
+using namespace std;
+
+Tokenizer::Tokenizer(const QString &separators, bool cs) : case_sensitive(cs)
+{
+    lookup_table_valid = parseCharacterClass(separators);
+    if (!lookup_table_valid){
+        regex.setPattern(separators);
+        regex.optimize();
+    }
+}
+
+bool Tokenizer::usesLookupTable() const { return lookup_table_valid; }
+
+// Parses patterns like "[…]" or "[…]+". Since empty parts are skipped, both
+// split equally. Supports literals, ranges, escaped literals, \s, \t, \n,
+// \r, \f and \v. Anything else is left to the regex engine.
+bool Tokenizer::parseCharacterClass(const QString &pattern)
+{
+    if (pattern.size() < 3 || pattern.front() != u'[')
+        return false;
+
+    qsizetype i = 1;
+    if (pattern[i] == u'^' || pattern[i] == u']')  // Negation and leading ] not supported
+        return false;
+
+    auto add = [this](char16_t first, char16_t last){
+        for (uint c = first; c <= last && c < 256; ++c)
+            latin1_separators.set(c);
+        if (last >= 256)
+            separator_ranges.emplace_back(max(first, (char16_t)256), last);
+    };
+
+    // Parses a single literal at i. Returns false if there is none.
+    auto literal = [&](char16_t &c){
+        if (i >= pattern.size() || pattern[i] == u']')
+            return false;
+        if (pattern[i] == u'[' && i + 1 < pattern.size()
+            && (pattern[i+1] == u':' || pattern[i+1] == u'.' || pattern[i+1] == u'='))
+            return false;  // POSIX classes
+        if (pattern[i] != u'\\'){
+            c = pattern[i++].unicode();
+            return true;
+        }
+        if (++i >= pattern.size())
+            return false;
+        switch (auto e = pattern[i].unicode()) {
+        case u't': c = u'\t'; break;
+        case u'n': c = u'\n'; break;
+        case u'r': c = u'\r'; break;
+        case u'f': c = u'\f'; break;
+        case u'v': c = u'\v'; break;
+        default:
+            if (pattern[i].isLetterOrNumber())  // Classes, back references, hex…
+                return false;
+            c = e;
+        }
+        ++i;
+        return true;
+    };
+
+    while (i < pattern.size() && pattern[i] != u']') {
+        if (pattern[i] == u'\\' && i + 1 < pattern.size() && pattern[i+1] == u's'){
+            // Without UseUnicodePropertiesOption \s matches ASCII whitespace only
+            for (char16_t c : {u' ', u'\t', u'\n', u'\v', u'\f', u'\r'})
+                latin1_separators.set(c);
+            i += 2;
+            continue;
+        }
+
+        char16_t first, last;
+        if (!literal(first))
+            return false;
+
+        if (i + 1 < pattern.size() && pattern[i] == u'-' && pattern[i+1] != u']'){
+            ++i;
+            if (!literal(last) || last < first)
+                return false;
+            add(first, last);
+        }
+        else
+            add(first, first);
+    }
+
+    if (i == pattern.size())  // Unterminated
+        return false;
+    ++i;
+
+    if (i < pattern.size() && pattern[i] == u'+')
+        ++i;
+
+    return i == pattern.size();
+}
+
+bool Tokenizer::isSeparator(QChar c) const
+{
+    if (c.unicode() < 256)
+        return latin1_separators.test(c.unicode());
+    for (const auto &[first, last] : separator_ranges)
+        if (first <= c.unicode() && c.unicode() <= last)
+            return true;
+    return false;
+}
+
+void Tokenizer::tokenize(const QString &string, QString &buffer, vector<QStringView> &words) const
+{
+    buffer = case_sensitive ? string : string.toLower();
+    words.clear();
+
+    if (lookup_table_valid){
+        const QChar *begin = buffer.constData(), *end = begin + buffer.size();
+        for (const QChar *c = begin; c != end;) {
+            while (c != end && isSeparator(*c))
+                ++c;
+            const QChar *word_begin = c;
+            while (c != end && !isSeparator(*c))
+                ++c;
+            if (word_begin != c)
+                words.emplace_back(word_begin, c - word_begin);
+        }
+    }
+    else {
+        qsizetype word_begin = 0;
+        for (auto it = regex.globalMatch(buffer); it.hasNext();) {
+            auto match = it.next();
+            if (match.capturedStart() > word_begin)
+                words.emplace_back(QStringView(buffer).mid(word_begin, match.capturedStart() - word_begin));
+            word_begin = max(word_begin, match.capturedEnd());
+        }
+        if (buffer.size() > word_begin)
+            words.emplace_back(QStringView(buffer).mid(word_begin));
+    }
+}
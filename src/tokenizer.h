@@ -0,0 +1,36 @@
+// Copyright (c) 2023 Manuel Schneider
+
+#pragma once
+#include <QRegularExpression>
+#include <QString>
+#include <QStringView>
+#include <bitset>
+#include <utility>
+#include <vector>
+
+// Splits strings into words at separators given as regular expression.
+// Patterns consisting of a single character class (the common case) are
+// compiled into a lookup table. Other patterns use a precompiled regex.
+class Tokenizer
+{
+public:
+    explicit Tokenizer(const QString &separators, bool case_sensitive);
+
+    /// Splits the string into non-empty words. Lowercases if case insensitive.
+    /// @param buffer Holds the (lowercased) string. The words point into it.
+    /// @param words Cleared and filled with the words.
+    void tokenize(const QString &string, QString &buffer, std::vector<QStringView> &words) const;
+
+    /// True if the separators are matched using the lookup table
+    bool usesLookupTable() const;
+
+private:
+    bool parseCharacterClass(const QString &pattern);
+    bool isSeparator(QChar c) const;
+
+    const bool case_sensitive;
+    bool lookup_table_valid;
+    std::bitset<256> latin1_separators;
+    std::vector<std::pair<char16_t, char16_t>> separator_ranges;  // Beyond latin1
+    QRegularExpression regex;
+};
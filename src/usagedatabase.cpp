@@ -11,6 +11,7 @@
 #include <QSqlDriver>
 #include <QSqlError>
 #include <QSqlQuery>
+#include <QThreadPool>
 #include <QTimer>
 #include <mutex>
 #include <shared_mutex>
@@ -19,76 +20,76 @@ using namespace albert;
 
 
 static const char* db_conn_name = "usagehistory";
+static const char* db_writer_conn_name = "usagehistory_writer";
+static const auto   DB_WRITE_DELAY = chrono::milliseconds(1000);
 static const char* db_file_name = "albert.db";
 static const char*  CFG_MEMORY_DECAY = "memoryDecay";
 static const double DEF_MEMORY_DECAY = 0.5;
 static const char*  CFG_PRIO_PERFECT = "prioritizePerfectMatch";
 static const bool   DEF_PRIO_PERFECT = true;
+static const char*  CFG_COMPACT_ACTIVATIONS = "compactActivations";
+static const bool   DEF_COMPACT_ACTIVATIONS = false;
+static const int    COMPACTION_THRESHOLD = 10000;  // Uncompacted activations triggering a compaction
+static const int    COMPACTION_KEEP = 1000;  // Most recent activations kept verbatim
 
 
 shared_mutex UsageHistory::global_data_mutex_;
-map<pair<QString,QString>,float> UsageHistory::usage_scores_;
+UsageScores UsageHistory::usage_scores_;
+mutex UsageHistory::usage_weights_mutex_;
+UsageWeights UsageHistory::usage_weights_;
+uint64_t UsageHistory::usage_weights_generation_ = 0;
+atomic<bool> UsageHistory::scores_update_scheduled_ = false;
 bool UsageHistory::prioritize_perfect_match_;
 double UsageHistory::memory_decay_;
+atomic<bool> UsageHistory::compact_activations_ = DEF_COMPACT_ACTIVATIONS;
 recursive_mutex UsageHistory::db_recursive_mutex_;
+thread UsageHistory::db_writer_;
+mutex UsageHistory::db_queue_mutex_;
+condition_variable UsageHistory::db_queue_condition_;
+vector<Activation> UsageHistory::db_queue_;
+uint64_t UsageHistory::db_queued_count_ = 0;
+uint64_t UsageHistory::db_written_count_ = 0;
+bool UsageHistory::db_flush_requested_ = false;
+bool UsageHistory::db_writer_stop_ = false;
 
 
-Activation::Activation(QString q, QString e, QString i, QString a):
-    query(::move(q)),extension_id(::move(e)),item_id(::move(i)),action_id(::move(a)){}
-
 void UsageHistory::initialize()
 {
     db_connect();
     db_initialize();
+    db_writer_ = thread(&UsageHistory::db_writerLoop, QDir(dataLocation()).filePath(db_file_name));
 
     auto s = settings();
     memory_decay_ = s->value(CFG_MEMORY_DECAY, DEF_MEMORY_DECAY).toDouble();
     prioritize_perfect_match_ = s->value(CFG_PRIO_PERFECT, DEF_PRIO_PERFECT).toBool();
+    compact_activations_ = s->value(CFG_COMPACT_ACTIVATIONS, DEF_COMPACT_ACTIVATIONS).toBool();
 
     updateScores();
 }
 
-void UsageHistory::applyScore(const QString &extension_id, RankItem *rank_item)
+void UsageHistory::finalize()
 {
-    /*
-     *  p  r     | ( 3, 4] |  3 + mru_score      | prioritized recent perfect matches
-     *  p !r     | ( 2, 3] |  2 + 1 / text_len   | prioritized perfect matches
-     * !p  r     | ( 1, 2] |  1 + mru_score      | recent matches
-     * !p !r  m  | ( 0, 1] |  match_score        | matches
-     * !p !r !m  | (-1, 0] |  -1 + 1 / text_len  | no match
-     */
-
-    if (prioritize_perfect_match_ && rank_item->score == 1.0f)
-        try {
-            rank_item->score = 3.0f + usage_scores_.at(make_pair(extension_id, rank_item->item->id()));
-        } catch (const out_of_range &){
-            rank_item->score = 2.0f + 1.0f / rank_item->item->text().length();
-        }
-    else
-        try {
-            rank_item->score = 1.0f + usage_scores_.at(make_pair(extension_id, rank_item->item->id()));
-        } catch (const out_of_range &){
-            if (rank_item->score == 0.0f)
-                rank_item->score = -1.0f + 1.0f / rank_item->item->text().length();
-            // else: the match string is initially okay
-        }
+    if (!db_writer_.joinable())
+        return;
+
+    {
+        lock_guard lock(db_queue_mutex_);
+        db_writer_stop_ = true;
+    }
+    db_queue_condition_.notify_all();
+    db_writer_.join();
 }
 
 void UsageHistory::applyScores(const QString &id, vector<RankItem> &rank_items)
 {
     shared_lock lock(global_data_mutex_);
-
-    for (auto &rank_item : rank_items)
-        applyScore(id, &rank_item);
+    usage_scores_.apply(id, rank_items, prioritize_perfect_match_);
 }
 
 void UsageHistory::applyScores(vector<pair<Extension *, RankItem>> *rank_items)
 {
     shared_lock lock(global_data_mutex_);
-
-    for (auto &[extension, rank_item] : *rank_items)
-        applyScore(extension->id(), &rank_item);
-
+    usage_scores_.apply(*rank_items, prioritize_perfect_match_);
 }
 
 double UsageHistory::memoryDecay()
@@ -121,44 +122,76 @@ void UsageHistory::setPrioritizePerfectMatch(bool value)
     prioritize_perfect_match_ = value;
 }
 
+bool UsageHistory::compactActivations() { return compact_activations_; }
+
+void UsageHistory::setCompactActivations(bool value)
+{
+    settings()->setValue(CFG_COMPACT_ACTIVATIONS, value);
+    compact_activations_ = value;
+}
+
 void UsageHistory::addActivation(const QString &qid, const QString &eid,
                                  const QString &iid, const QString &aid)
 {
     db_addActivation(qid, eid, iid, aid);
-    updateScores();
+
+    if (iid.isEmpty())  // Not part of the scores, see db_usageWeights()
+        return;
+
+    {
+        lock_guard lock(usage_weights_mutex_);
+        usage_weights_.add(eid, iid);
+        ++usage_weights_generation_;
+    }
+
+    scheduleScoresUpdate();
+}
+
+void UsageHistory::scheduleScoresUpdate()
+{
+    // Rank the weights in the background. Activations added while a
+    // rebuild is scheduled are picked up by that rebuild.
+    if (scores_update_scheduled_.exchange(true))
+        return;
+
+    QThreadPool::globalInstance()->start([]{
+        TimePrinter tp("%1 ms updating usage scores.");
+
+        UsageWeights usage_weights;
+        uint64_t generation;
+        {
+            lock_guard lock(usage_weights_mutex_);
+            scores_update_scheduled_ = false;
+            usage_weights = usage_weights_;
+            generation = usage_weights_generation_;
+        }
+
+        UsageScores usage_scores(usage_weights);
+
+        // Do not overwrite the scores of newer weights
+        lock_guard weights_lock(usage_weights_mutex_);
+        if (generation == usage_weights_generation_) {
+            unique_lock lock(global_data_mutex_);
+            usage_scores_ = ::move(usage_scores);
+        }
+    });
 }
 
 void UsageHistory::updateScores()
 {
-    TimePrinter tp("%1 ms fetching activations.");
+    db_flush();
 
-    vector<Activation> activations = db_activations();
+    TimePrinter tp("%1 ms fetching usage weights.");
+
+    UsageWeights usage_weights = db_usageWeights(memoryDecay());
 
     tp.restart("%1 ms computing usage scores.");
 
-    // Compute usage weights
-    map<pair<QString,QString>, double> usage_weights;
-    for (int i = 0, k = (int)activations.size(); i < (int)activations.size(); ++i, --k){
-        auto activation = activations[i];
-        double weight = pow(memory_decay_, k);
-        if (const auto &[it, success] = usage_weights.emplace(make_pair(activation.extension_id, activation.item_id), weight); !success)
-            it->second += weight;
-    }
+    UsageScores usage_scores(usage_weights);
 
-    // Invert the list. Results in ordered by rank map
-    map<double,vector<pair<QString,QString>>> weight_items;
-    for (const auto &[ids, weight] : usage_weights)
-        weight_items[weight].emplace_back(ids);
-
-    // Distribute scores linearly over the interval preserving the order
-    map<pair<QString,QString>,float> usage_scores;
-    double rank = 0.0;
-    for (const auto &[weight, vids] : weight_items){
-        double score = rank / weight_items.size();
-        for (const auto &ids : vids)
-            usage_scores.emplace(ids, score);
-        rank += 1.0;
-    }
+    lock_guard weights_lock(usage_weights_mutex_);
+    usage_weights_ = ::move(usage_weights);
+    ++usage_weights_generation_;
 
     unique_lock lock(global_data_mutex_);
     usage_scores_ = ::move(usage_scores);
@@ -196,6 +229,10 @@ void UsageHistory::db_connect()
 
     if (!db.open())
         qFatal("Database: Unable to establish connection: %s", qPrintable(db.lastError().text()));
+
+    // Readers do not block the writer thread and vice versa
+    if (QSqlQuery sql(db); !sql.exec("PRAGMA journal_mode=WAL;"))
+        WARN << "Database: Failed to enable write-ahead logging:" << sql.lastError().text();
 }
 
 void UsageHistory::db_initialize()
@@ -215,54 +252,216 @@ void UsageHistory::db_initialize()
              "); ");
     if (!sql.isActive())
         qFatal("Unable to create table 'activation': %s", sql.lastError().text().toUtf8().constData());
+
+    // Compacted activations. The weights are relative to the first activation
+    // in the activation table, i.e. decayed by every activation there.
+    sql.exec("CREATE TABLE IF NOT EXISTS activation_aggregate ( "
+             "    extension_id TEXT NOT NULL, "
+             "    item_id TEXT NOT NULL, "
+             "    weight REAL NOT NULL, "
+             "    PRIMARY KEY (extension_id, item_id) "
+             ") WITHOUT ROWID; ");
+    if (!sql.isActive())
+        qFatal("Unable to create table 'activation_aggregate': %s", sql.lastError().text().toUtf8().constData());
 }
 
 void UsageHistory::db_clearActivations()
 {
+    db_flush();
+
     unique_lock lock(db_recursive_mutex_);
 
     DEBG << "Database: Clearing activations…";
     TimePrinter tp("Database: Activations cleared (%1 ms).");
 
     QSqlDatabase::database(db_conn_name).exec("DROP TABLE activation;");
+    QSqlDatabase::database(db_conn_name).exec("DROP TABLE activation_aggregate;");
     db_initialize();
 }
 
-vector<Activation> UsageHistory::db_activations()
+UsageWeights UsageHistory::db_usageWeights(double memory_decay)
 {
     unique_lock lock(db_recursive_mutex_);
 
-    DEBG << "Database: Fetching activations…";
-    TimePrinter tp("Database: Activations fetched (%1 ms).");
+    DEBG << "Database: Fetching usage weights…";
+    TimePrinter tp("Database: Usage weights fetched (%1 ms).");
 
-    QSqlQuery sql(QSqlDatabase::database(db_conn_name));
-    sql.exec("SELECT query, extension_id, item_id, action_id "
-             "FROM activation WHERE item_id<>''");
+    auto db = QSqlDatabase::database(db_conn_name);
+    db.transaction();  // Consistent snapshot in case the writer compacts meanwhile
+
+    UsageWeights usage_weights({}, memory_decay);
+    QSqlQuery sql(db);
+    sql.setForwardOnly(true);
+
+    sql.exec("SELECT extension_id, item_id, weight FROM activation_aggregate");
+    if (!sql.isActive())
+        qFatal("SQL ERROR: %s %s", qPrintable(sql.executedQuery()), qPrintable(sql.lastError().text()));
+    uint aggregated = 0;
+    for (; sql.next(); ++aggregated)
+        usage_weights.addWeight(sql.value(0).toString(), sql.value(1).toString(), sql.value(2).toDouble());
 
+    sql.exec("SELECT extension_id, item_id FROM activation WHERE item_id<>'' ORDER BY rowid");
     if (!sql.isActive())
         qFatal("SQL ERROR: %s %s", qPrintable(sql.executedQuery()), qPrintable(sql.lastError().text()));
+    uint activations = 0;
+    for (; sql.next(); ++activations)
+        usage_weights.add(sql.value(0).toString(), sql.value(1).toString());
+
+    db.commit();
+
+    DEBG << QString("Database: %1 aggregated items, %2 activations.").arg(aggregated).arg(activations);
+    return usage_weights;
+}
+
+void UsageHistory::db_compact(QSqlDatabase &db)
+{
+    // Fold all but the most recent activations into the aggregate table.
+    // Bounds the rows read at startup. Note that the aggregate keeps the
+    // memory decay of the time of compaction.
+    QSqlQuery sql(db);
+    sql.setForwardOnly(true);
+
+    sql.exec("SELECT min(rowid), max(rowid) FROM activation");
+    if (!sql.next() || sql.value(0).isNull()
+        || sql.value(1).toLongLong() - sql.value(0).toLongLong() < COMPACTION_THRESHOLD)
+        return;
+    const auto last_compacted = sql.value(1).toLongLong() - COMPACTION_KEEP;
+    sql.finish();
+
+    auto size = [&db]{
+        QSqlQuery pragma(db);
+        pragma.exec("SELECT page_count * page_size FROM pragma_page_count(), pragma_page_size()");
+        return pragma.next() ? pragma.value(0).toLongLong() : 0;
+    };
+    const auto size_before = size();
+
+    TimePrinter tp("Database: Activations compacted (%1 ms).");
+
+    db.transaction();
+
+    UsageWeights usage_weights({}, memoryDecay());
 
-    vector<Activation> activations;
+    sql.exec("SELECT extension_id, item_id, weight FROM activation_aggregate");
     while (sql.next())
-        activations.emplace_back(sql.value(0).toString(), sql.value(1).toString(),
-                                 sql.value(2).toString(), sql.value(3).toString());
-    return activations;
+        usage_weights.addWeight(sql.value(0).toString(), sql.value(1).toString(), sql.value(2).toDouble());
+
+    sql.prepare("SELECT extension_id, item_id FROM activation "
+                "WHERE rowid <= :last AND item_id<>'' ORDER BY rowid");
+    sql.bindValue(":last", last_compacted);
+    sql.exec();
+    uint compacted = 0;
+    for (; sql.next(); ++compacted)
+        usage_weights.add(sql.value(0).toString(), sql.value(1).toString());
+
+    bool success = sql.exec("DELETE FROM activation_aggregate");
+
+    sql.prepare("INSERT INTO activation_aggregate (extension_id, item_id, weight) "
+                "VALUES (:extension_id, :item_id, :weight)");
+    usage_weights.forEach([&](const QString &extension_id, const QString &item_id, double weight){
+        sql.bindValue(":extension_id", extension_id);
+        sql.bindValue(":item_id", item_id);
+        sql.bindValue(":weight", weight);
+        success = sql.exec() && success;
+    });
+
+    sql.prepare("DELETE FROM activation WHERE rowid <= :last");
+    sql.bindValue(":last", last_compacted);
+    success = sql.exec() && success;
+
+    if (!success || !db.commit()) {
+        CRIT << "Database: Compaction failed:" << sql.lastError().text() << db.lastError().text();
+        db.rollback();
+        return;
+    }
+
+    sql.finish();
+    sql.exec("VACUUM");
+
+    INFO << QString("Database: Compacted %1 activations. Size %2 KiB → %3 KiB.")
+                .arg(compacted).arg(size_before / 1024).arg(size() / 1024);
 }
 
 void UsageHistory::db_addActivation(const QString &q, const QString &e, const QString &i, const QString &a)
 {
-    unique_lock lock(db_recursive_mutex_);
+    {
+        lock_guard lock(db_queue_mutex_);
+        db_queue_.emplace_back(q, e, i, a);
+        ++db_queued_count_;
+    }
+    db_queue_condition_.notify_all();
+}
 
-    DEBG << "Database: Adding activation…";
-    TimePrinter tp("Database: Activation added (%1 ms).");
+void UsageHistory::db_flush()
+{
+    if (!db_writer_.joinable())
+        return;
 
-    QSqlQuery sql(QSqlDatabase::database(db_conn_name));
-    sql.prepare("INSERT INTO activation (query, extension_id, item_id, action_id) "
-                "VALUES (:query, :extension_id, :item_id, :action_id);");
-    sql.bindValue(":query", q);
-    sql.bindValue(":extension_id", e);
-    sql.bindValue(":item_id", i);
-    sql.bindValue(":action_id", a);
-    if (!sql.exec())
-        qFatal("SQL ERROR: %s %s", qPrintable(sql.executedQuery()), qPrintable(sql.lastError().text()));
+    DEBG << "Database: Flushing activations…";
+    TimePrinter tp("Database: Activations flushed (%1 ms).");
+
+    unique_lock lock(db_queue_mutex_);
+    const auto target = db_queued_count_;
+    db_flush_requested_ = true;
+    db_queue_condition_.notify_all();
+    db_queue_condition_.wait(lock, [target]{ return db_written_count_ >= target; });
+}
+
+void UsageHistory::db_writerLoop(QString database_path)
+{
+    {
+        auto db = QSqlDatabase::addDatabase("QSQLITE", db_writer_conn_name);
+        db.setDatabaseName(database_path);
+        if (!db.open())
+            qFatal("Database: Unable to establish writer connection: %s", qPrintable(db.lastError().text()));
+
+        // Durable in WAL mode, except for the last transactions on power loss
+        QSqlQuery(db).exec("PRAGMA synchronous=NORMAL;");
+
+        QSqlQuery sql(db);
+        if (!sql.prepare("INSERT INTO activation (query, extension_id, item_id, action_id) "
+                         "VALUES (:query, :extension_id, :item_id, :action_id);"))
+            qFatal("SQL ERROR: %s %s", qPrintable(sql.lastQuery()), qPrintable(sql.lastError().text()));
+
+        unique_lock lock(db_queue_mutex_);
+        while (true) {
+            db_queue_condition_.wait(lock, []{ return !db_queue_.empty() || db_writer_stop_; });
+
+            // Give subsequent activations the chance to join the transaction
+            db_queue_condition_.wait_for(lock, DB_WRITE_DELAY,
+                                         []{ return db_writer_stop_ || db_flush_requested_; });
+            db_flush_requested_ = false;
+
+            auto batch = ::move(db_queue_);
+            db_queue_.clear();
+            lock.unlock();
+
+            if (!batch.empty()) {
+                DEBG << QString("Database: Writing %1 activations…").arg(batch.size());
+                TimePrinter tp("Database: Activations written (%1 ms).");
+
+                db.transaction();
+                for (const auto &activation : batch) {
+                    sql.bindValue(":query", activation.query);
+                    sql.bindValue(":extension_id", activation.extension_id);
+                    sql.bindValue(":item_id", activation.item_id);
+                    sql.bindValue(":action_id", activation.action_id);
+                    if (!sql.exec())
+                        CRIT << "SQL ERROR:" << sql.executedQuery() << sql.lastError().text();
+                }
+                if (!db.commit())
+                    CRIT << "Database: Failed to commit activations:" << db.lastError().text();
+            }
+
+            if (compact_activations_ && !batch.empty())
+                db_compact(db);
+
+            lock.lock();
+            db_written_count_ += batch.size();
+            db_queue_condition_.notify_all();
+
+            if (db_writer_stop_ && db_queue_.empty())
+                break;
+        }
+    }
+    QSqlDatabase::removeDatabase(db_writer_conn_name);
 }
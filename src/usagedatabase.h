@@ -1,30 +1,28 @@
 // Copyright (c) 2022 Manuel Schneider
 
 #pragma once
+#include "usagescores.h"
 #include <QSqlDatabase>
 #include <QString>
+#include <atomic>
+#include <condition_variable>
 #include <vector>
 #include <shared_mutex>
 #include <mutex>
-#include <map>
+#include <thread>
 namespace albert {
 class Extension;
 class RankItem;
 }
 
-struct Activation {
-    Activation(QString q, QString e, QString i, QString a);
-    QString query;
-    QString extension_id;
-    QString item_id;
-    QString action_id;
-};
-
 class UsageHistory
 {
 public:
     static void initialize();
 
+    /// Writes the queued activations and stops the database writer.
+    static void finalize();
+
     static void applyScores(const QString &id, std::vector<albert::RankItem> &rank_items);
     static void applyScores(std::vector<std::pair<albert::Extension*,albert::RankItem>>*);
 
@@ -34,25 +32,49 @@ public:
     static bool prioritizePerfectMatch();
     static void setPrioritizePerfectMatch(bool);
 
+    /// Periodically fold old activations into per item weights.
+    static bool compactActivations();
+    static void setCompactActivations(bool);
+
     static void addActivation(const QString &query, const QString &extension,
                               const QString &item, const QString &action);
 
 private:
-    inline static void applyScore(const QString &extension_id, albert::RankItem *rank_item);
     static void updateScores();
+    static void scheduleScoresUpdate();
 
     static std::shared_mutex global_data_mutex_;
-    static std::map<std::pair<QString,QString>,float> usage_scores_;
+    static UsageScores usage_scores_;
+
+    static std::mutex usage_weights_mutex_;
+    static UsageWeights usage_weights_;
+    static uint64_t usage_weights_generation_;
+    static std::atomic<bool> scores_update_scheduled_;
     static bool prioritize_perfect_match_;
     static double memory_decay_;
+    static std::atomic<bool> compact_activations_;
 
     static std::recursive_mutex db_recursive_mutex_;
     static void db_connect();
     static void db_initialize();
     static void db_clearActivations();
-    static std::vector<Activation> db_activations();
+    static UsageWeights db_usageWeights(double memory_decay);
+    static void db_compact(QSqlDatabase &);
     static void db_addActivation(const QString &query, const QString &extension,
                                  const QString &item, const QString &action);
+
+    // Write-behind queue. Activations are written in batches by the writer
+    // thread, which uses its own connection.
+    static void db_flush();
+    static void db_writerLoop(QString database_path);
+    static std::thread db_writer_;
+    static std::mutex db_queue_mutex_;
+    static std::condition_variable db_queue_condition_;
+    static std::vector<Activation> db_queue_;
+    static uint64_t db_queued_count_;
+    static uint64_t db_written_count_;
+    static bool db_flush_requested_;
+    static bool db_writer_stop_;
 };
 
 
@@ -0,0 +1,146 @@
+// Copyright (c) 2023 Manuel Schneider
+
+#include "albert/extension.h"
+#include "albert/extension/queryhandler/rankitem.h"
+#include "usagescores.h"
+#include <map>
+using namespace albert;
+using namespace std;
+static const double MIN_SCALE = 1e-100;
+
+Activation::Activation(QString q, QString e, QString i, QString a):
+    query(::move(q)),extension_id(::move(e)),item_id(::move(i)),action_id(::move(a)){}
+
+UsageWeights::UsageWeights(const vector<Activation> &activations, double memory_decay):
+    memory_decay_(memory_decay)
+{
+    for (const auto &activation : activations)
+        add(activation.extension_id, activation.item_id);
+}
+
+void UsageWeights::add(const QString &extension_id, const QString &item_id)
+{
+    // Decaying the scale decays all former weights. The new activation gets
+    // the weight memory_decay_, i.e. the stored weight memory_decay_ / scale_.
+    scale_ *= memory_decay_;
+    if (scale_ < MIN_SCALE)
+        normalize();
+    weights_[extension_id][item_id] += memory_decay_ / scale_;
+}
+
+void UsageWeights::addWeight(const QString &extension_id, const QString &item_id, double weight)
+{
+    weights_[extension_id][item_id] += weight / scale_;
+}
+
+double UsageWeights::weight(const QString &extension_id, const QString &item_id) const
+{
+    if (auto eit = weights_.find(extension_id); eit != weights_.end())
+        if (auto iit = eit->second.find(item_id); iit != eit->second.end())
+            return iit->second * scale_;
+    return 0.0;
+}
+
+void UsageWeights::forEach(const function<void(const QString&, const QString&, double)> &f) const
+{
+    for (const auto &[extension_id, item_weights] : weights_)
+        for (const auto &[item_id, weight] : item_weights)
+            f(extension_id, item_id, weight * scale_);
+}
+
+void UsageWeights::normalize()
+{
+    // Amortized: happens once in log(MIN_SCALE)/log(memory_decay_) activations
+    for (auto &[extension_id, item_weights] : weights_)
+        for (auto &[item_id, weight] : item_weights)
+            weight *= scale_;
+    scale_ = 1.0;
+}
+
+UsageScores::UsageScores(const UsageWeights &usage_weights)
+{
+    // Invert the weights. Results in ordered by rank map
+    map<double, vector<pair<const QString*, const QString*>>> weight_items;
+    for (const auto &[extension_id, item_weights] : usage_weights.weights_)
+        for (const auto &[item_id, weight] : item_weights)
+            weight_items[weight * usage_weights.scale_].emplace_back(&extension_id, &item_id);
+
+    // Distribute scores linearly over the interval preserving the order
+    double rank = 0.0;
+    for (const auto &[weight, vids] : weight_items){
+        float score = (float)(rank / weight_items.size());
+        for (const auto &[extension_id, item_id] : vids) {
+            auto [it, success] = extension_ids_.emplace(*extension_id, (uint32_t)item_scores_.size());
+            if (success)
+                item_scores_.emplace_back();
+            item_scores_[it->second].emplace(*item_id, score);
+            ++size_;
+        }
+        rank += 1.0;
+    }
+}
+
+UsageScores::UsageScores(const vector<Activation> &activations, double memory_decay):
+    UsageScores(UsageWeights(activations, memory_decay)) {}
+
+const UsageScores::ItemScores *UsageScores::itemScores(const QString &extension_id) const
+{
+    if (auto it = extension_ids_.find(extension_id); it != extension_ids_.end())
+        return &item_scores_[it->second];
+    return nullptr;
+}
+
+const float *UsageScores::score(const QString &extension_id, const QString &item_id) const
+{
+    if (auto *item_scores = itemScores(extension_id))
+        if (auto it = item_scores->find(item_id); it != item_scores->end())
+            return &it->second;
+    return nullptr;
+}
+
+void UsageScores::apply(const ItemScores *item_scores, RankItem &rank_item, bool prioritize_perfect_match)
+{
+    /*
+     *  p  r     | ( 3, 4] |  3 + mru_score      | prioritized recent perfect matches
+     *  p !r     | ( 2, 3] |  2 + 1 / text_len   | prioritized perfect matches
+     * !p  r     | ( 1, 2] |  1 + mru_score      | recent matches
+     * !p !r  m  | ( 0, 1] |  match_score        | matches
+     * !p !r !m  | (-1, 0] |  -1 + 1 / text_len  | no match
+     */
+
+    const float *usage_score = nullptr;
+    if (item_scores)
+        if (auto it = item_scores->find(rank_item.item->id()); it != item_scores->end())
+            usage_score = &it->second;
+
+    if (prioritize_perfect_match && rank_item.score == 1.0f)
+        rank_item.score = usage_score ? 3.0f + *usage_score
+                                      : 2.0f + 1.0f / rank_item.item->text().length();
+    else if (usage_score)
+        rank_item.score = 1.0f + *usage_score;
+    else if (rank_item.score == 0.0f)
+        rank_item.score = -1.0f + 1.0f / rank_item.item->text().length();
+    // else: the match string is initially okay
+}
+
+void UsageScores::apply(const QString &extension_id, vector<RankItem> &rank_items,
+                        bool prioritize_perfect_match) const
+{
+    const auto *item_scores = itemScores(extension_id);
+    for (auto &rank_item : rank_items)
+        apply(item_scores, rank_item, prioritize_perfect_match);
+}
+
+void UsageScores::apply(vector<pair<Extension*, RankItem>> &rank_items, bool prioritize_perfect_match) const
+{
+    // Results are grouped by extension usually. Look up the extension once per group.
+    Extension *extension = nullptr;
+    const ItemScores *item_scores = nullptr;
+    for (auto &[e, rank_item] : rank_items) {
+        if (e != extension)
+            item_scores = itemScores((extension = e)->id());
+        apply(item_scores, rank_item, prioritize_perfect_match);
+    }
+}
+
+size_t UsageScores::size() const { return size_; }
@@ -0,0 +1,94 @@
+// Copyright (c) 2023 Manuel Schneider
+
+#pragma once
+#include <QString>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+namespace albert {
+class Extension;
+class RankItem;
+}
+
+struct Activation {
+    Activation(QString q, QString e, QString i, QString a);
+    QString query;
+    QString extension_id;
+    QString item_id;
+    QString action_id;
+};
+
+class UsageScores;
+
+/// Decayed activation weights per item.
+/// Every activation decays the weights of all former activations by the
+/// memory decay. Instead of touching all weights, a common scale factor is
+/// decayed, which makes adding an activation O(1) amortized.
+class UsageWeights
+{
+public:
+    UsageWeights() = default;
+
+    /// Folds the activations, oldest first.
+    UsageWeights(const std::vector<Activation> &activations, double memory_decay);
+
+    /// Folds a new activation. O(1) amortized.
+    void add(const QString &extension_id, const QString &item_id);
+
+    /// Adds to the weight of the item without decaying the others.
+    /// Used to restore aggregated weights.
+    void addWeight(const QString &extension_id, const QString &item_id, double weight);
+
+    /// The weight of the item. Zero if it has never been activated.
+    double weight(const QString &extension_id, const QString &item_id) const;
+
+    /// Calls the function for every item ever activated.
+    void forEach(const std::function<void(const QString &extension_id, const QString &item_id,
+                                          double weight)> &) const;
+
+private:
+    // Per extension id, per item id, unscaled weight
+    std::unordered_map<QString, std::unordered_map<QString, double>> weights_;
+    double memory_decay_ = 0.5;
+    double scale_ = 1.0;  // The actual weights are the stored ones times scale_
+
+    void normalize();
+
+    friend class UsageScores;
+};
+
+/// Hashed usage score table.
+/// Extension ids are interned, such that a lookup costs one hash lookup of
+/// the item id. Lookups neither allocate nor throw.
+class UsageScores
+{
+public:
+    UsageScores() = default;
+
+    /// Distributes the scores by the rank of the weights. O(n log n).
+    explicit UsageScores(const UsageWeights &);
+
+    /// Computes the scores of the activations, oldest first.
+    UsageScores(const std::vector<Activation> &activations, double memory_decay);
+
+    /// The usage score of the item in [0,1) or nullptr if the item has never been activated.
+    const float *score(const QString &extension_id, const QString &item_id) const;
+
+    void apply(const QString &extension_id, std::vector<albert::RankItem> &,
+               bool prioritize_perfect_match) const;
+    void apply(std::vector<std::pair<albert::Extension*, albert::RankItem>> &,
+               bool prioritize_perfect_match) const;
+
+    size_t size() const;
+
+private:
+    using ItemScores = std::unordered_map<QString, float>;
+
+    const ItemScores *itemScores(const QString &extension_id) const;
+    static void apply(const ItemScores *, albert::RankItem &, bool prioritize_perfect_match);
+
+    std::unordered_map<QString, uint32_t> extension_ids_;  // Interned extension ids
+    std::vector<ItemScores> item_scores_;  // Indexed by interned extension id
+    size_t size_ = 0;
+};
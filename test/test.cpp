@@ -5,12 +5,27 @@
 #include "albert/extension/queryhandler/indexitem.h"
 #include "albert/extension/queryhandler/standarditem.h"
 #include "albert/extension/queryhandler/rankitem.h"
+#include "albert/util/iconprovider.h"
 #include "doctest/doctest.h"
 #include "src/itemindex.h"
 #include "src/levenshtein.h"
+#include "src/tokenizer.h"
+#include "src/usagescores.h"
+#include <QApplication>
+#include <QDir>
+#include <QRegularExpression>
+#include <QFile>
 #include <QString>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#if defined(Q_OS_LINUX)
+#include "src/platform/Linux/xdg/iconlookup.h"
+#endif
 #include <chrono>
+#include <cmath>
 #include <iostream>
+#include <map>
+#include <thread>
 using namespace albert;
 using namespace std;
 using namespace std::chrono;
@@ -36,7 +51,8 @@ std::string gen_random(const int len) {
 void levenshtein_compare_benchmarks_and_check_results(const vector<QString> &strings, uint k){
     Levenshtein l;
     vector<bool> results_old;
-    vector<bool> results_new;
+    vector<uint> results_dp;
+    vector<uint> results_bp;
 
     results_old.reserve(strings.size());
     auto start = system_clock::now();
@@ -46,17 +62,31 @@ void levenshtein_compare_benchmarks_and_check_results(const vector<QString> &str
         results_old.push_back(l.checkPrefixEditDistance_Legacy(*i, *j, k));
     long duration_old = duration_cast<microseconds>(system_clock::now()-start).count();
 
-    results_new.reserve(strings.size());
+    results_dp.reserve(strings.size());
+    start = system_clock::now();
+    i = strings.cbegin();
+    j = strings.crbegin();
+    for (; i != strings.cend(); ++i, ++j)
+        results_dp.push_back(l.computePrefixEditDistanceWithLimit_DP(*i, *j, k));
+    long duration_dp = duration_cast<microseconds>(system_clock::now()-start).count();
+
+    results_bp.reserve(strings.size());
     start = system_clock::now();
     i = strings.cbegin();
     j = strings.crbegin();
     for (; i != strings.cend(); ++i, ++j)
-        results_new.push_back(l.computePrefixEditDistanceWithLimit(*i, *j, k) <= k);
-    long duration_new = duration_cast<microseconds>(system_clock::now()-start).count();
+        results_bp.push_back(l.computePrefixEditDistanceWithLimit_BitParallel(*i, *j, k));
+    long duration_bp = duration_cast<microseconds>(system_clock::now()-start).count();
 
-    cout << "Levensthein old: " << setw(12)<<duration_old << " µs. New: "<< setw(12) << duration_new
-         << " µs. Ratio: " << duration_new/(float)duration_old <<endl;
+    cout << "Levensthein old: " << setw(9) << duration_old
+         << " µs. DP: " << setw(9) << duration_dp << " µs (" << duration_dp/(float)duration_old << ")"
+         << ". Bit-parallel: " << setw(9) << duration_bp << " µs (" << duration_bp/(float)duration_old << ")" << endl;
+
+    vector<bool> results_new;
+    for (auto d : results_dp)
+        results_new.push_back(d <= k);
     CHECK(results_old == results_new);
+    CHECK(results_dp == results_bp);
 }
 
 TEST_CASE("Benchmark new levenshtein")
@@ -66,7 +96,7 @@ TEST_CASE("Benchmark new levenshtein")
     srand((unsigned)time(NULL) * getpid());
 
     vector<QString> strings(test_count);
-    auto lens = {4,8,16,24};
+    auto lens = {4,8,16,24,64};
     auto divisor=4;
     cout << "Randoms"<<endl;
     for (int len : lens){
@@ -141,6 +171,28 @@ TEST_CASE("Levenshtein")
     CHECK(l.computePrefixEditDistanceWithLimit("abc", "ab", 1) == 1);
     CHECK(l.computePrefixEditDistanceWithLimit("abc", "a", 1) == 2);
     CHECK(l.computePrefixEditDistanceWithLimit("abc", "", 1) == 2);
+
+    // Non latin1 chars
+    CHECK(l.computePrefixEditDistanceWithLimit(u"ääö€", u"aäö€", 1) == 1);
+    CHECK(l.computePrefixEditDistanceWithLimit(u"ääö€", u"ääö€€", 1) == 0);
+
+    // Prefixes longer than 64 chars fall back to the DP
+    CHECK(l.computePrefixEditDistanceWithLimit(QString(70, 'a'), QString(70, 'a'), 3) == 0);
+    CHECK(l.computePrefixEditDistanceWithLimit(QString(70, 'a'), QString(68, 'a') + "bb", 3) == 2);
+
+    // Bit-parallel and DP agree
+    srand(0);
+    for (int n = 0; n < 10000; ++n) {
+        QString prefix, string;
+        for (int c = rand() % 66; c > 0; --c)
+            prefix += QChar(u"ab€"[rand() % 3]);
+        for (int c = rand() % 70; c > 0; --c)
+            string += QChar(u"ab€"[rand() % 3]);
+        uint k = rand() % 6;
+        if (prefix.size() <= 64)
+            CHECK(l.computePrefixEditDistanceWithLimit_BitParallel(prefix, string, k)
+                  == l.computePrefixEditDistanceWithLimit_DP(prefix, string, k));
+    }
 }
 
 TEST_CASE("Index")
@@ -204,3 +256,720 @@ TEST_CASE("Index")
     CHECK(qFuzzyCompare(M[1].score, 3.0f/6.0f));
     CHECK(qFuzzyCompare(M[2].score, 2.0f/3.0f));
 }
+
+TEST_CASE("Index incremental updates")
+{
+    auto ids = [](const vector<RankItem> &rank_items){
+        QStringList l;
+        for (const auto &rank_item : rank_items)
+            l << rank_item.item->id();
+        l.sort();
+        return l;
+    };
+
+    auto item = [](const QString &id, const QString &string){
+        return IndexItem(make_shared<StandardItem>(id, string), string);
+    };
+
+    auto index = ItemIndex("[ ]+", false, 2, 3);
+    index.setItems({item("1", "abc def"), item("2", "abd xyz")});
+    CHECK(ids(index.search("ab", true)) == QStringList{"1", "2"});
+
+    // add
+    index.updateItems({}, {item("3", "abc xyz")});
+    CHECK(ids(index.search("abc", true)) == QStringList{"1", "2", "3"});  // fuzzy 'abd'
+    CHECK(ids(index.search("xyz", true)) == QStringList{"2", "3"});
+
+    // remove
+    index.updateItems({"1"}, {});
+    CHECK(ids(index.search("abc", true)) == QStringList{"2", "3"});
+    CHECK(ids(index.search("", true)) == QStringList{"2", "3"});
+
+    // replace
+    index.updateItems({"2"}, {item("2", "def")});
+    CHECK(ids(index.search("xyz", true)) == QStringList{"3"});
+    CHECK(ids(index.search("def", true)) == QStringList{"2"});
+
+    // many small updates trigger segment merges
+    for (int i = 0; i < 100; ++i)
+        index.updateItems({}, {item(QString::number(100 + i), "abc")});
+    CHECK(index.search("abc", true).size() == 101);
+
+    QStringList removed_ids;
+    for (int i = 0; i < 100; i+=2)
+        removed_ids << QString::number(100 + i);
+    index.updateItems(removed_ids, {});
+    CHECK(index.search("abc", true).size() == 51);
+
+    // scores equal a full rebuild
+    auto rebuilt = ItemIndex("[ ]+", false, 2, 3);
+    rebuilt.setItems({item("a", "abc def"), item("b", "abcdef")});
+    auto incremental = ItemIndex("[ ]+", false, 2, 3);
+    incremental.setItems({item("a", "abc def"), item("x", "abc")});
+    incremental.updateItems({"x"}, {item("b", "abcdef")});
+    auto r = rebuilt.search("abc", true);
+    auto i = incremental.search("abc", true);
+    sort(r.begin(), r.end(), [](auto &a, auto &b){ return a.item->id() < b.item->id(); });
+    sort(i.begin(), i.end(), [](auto &a, auto &b){ return a.item->id() < b.item->id(); });
+    REQUIRE(r.size() == i.size());
+    for (size_t k = 0; k < r.size(); ++k)
+        CHECK(qFuzzyCompare(r[k].score, i[k].score));
+}
+
+TEST_CASE("Index search cache")
+{
+    auto scores = [](vector<RankItem> rank_items){
+        sort(rank_items.begin(), rank_items.end(), [](auto &a, auto &b){ return a.item->id() < b.item->id(); });
+        vector<pair<QString, float>> l;
+        for (const auto &rank_item : rank_items)
+            l.emplace_back(rank_item.item->id(), rank_item.score);
+        return l;
+    };
+
+    auto item = [](const QString &id, const QString &string){
+        return IndexItem(make_shared<StandardItem>(id, string), string);
+    };
+
+    vector<IndexItem> items{item("1", "firefox web browser"), item("2", "firewall"),
+                            item("3", "fyrefox"), item("4", "thunderbird mail"),
+                            item("5", "file manager"), item("6", "fire fighter")};
+
+    // Typing refines the previous results, which must equal uncached searches
+    for (uint error_tolerance_divisor : {0u, 3u}) {
+        auto typed = ItemIndex("[ ]+", false, 2, error_tolerance_divisor);
+        typed.setItems(vector<IndexItem>(items));
+        QString query = "firefox brows";
+        for (int l = 1; l <= query.size(); ++l) {
+            auto fresh = ItemIndex("[ ]+", false, 2, error_tolerance_divisor);
+            fresh.setItems(vector<IndexItem>(items));
+            CHECK(scores(typed.search(query.left(l), true)) == scores(fresh.search(query.left(l), true)));
+        }
+
+        // Deleting chars hits the cache
+        const auto hits = typed.searchCacheHits();
+        auto fresh = ItemIndex("[ ]+", false, 2, error_tolerance_divisor);
+        fresh.setItems(vector<IndexItem>(items));
+        CHECK(scores(typed.search("fire", true)) == scores(fresh.search("fire", true)));
+        CHECK(typed.searchCacheHits() == hits + 1);
+
+        // Updates invalidate the cache
+        CHECK(typed.search("thunder", true).size() == 1);
+        typed.updateItems({"4"}, {});
+        CHECK(typed.search("thunder", true).empty());
+        typed.updateItems({}, {item("7", "thunder")});
+        CHECK(typed.search("thunde", true).size() == 1);
+    }
+}
+
+TEST_CASE("Index snapshot")
+{
+    auto scores = [](vector<RankItem> rank_items){
+        sort(rank_items.begin(), rank_items.end(), [](auto &a, auto &b){ return a.item->id() < b.item->id(); });
+        vector<pair<QString, float>> l;
+        for (const auto &rank_item : rank_items)
+            l.emplace_back(rank_item.item->id(), rank_item.score);
+        return l;
+    };
+
+    auto item = [](const QString &id, const QString &string){
+        vector<Action> actions{{"run", "Run", []{}}};
+        return IndexItem(make_shared<StandardItem>(id, string, "sub " + id, QString(), QStringList{"xdg:" + id}, actions),
+                         string);
+    };
+
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+    const auto path = dir.filePath("test.index");
+
+    // Segments and removals get merged into the snapshot
+    auto index = make_shared<ItemIndex>("[ ]+", false, 2, 3);
+    index->setItems({item("1", "firefox web browser"), item("2", "firewall"), item("3", "fyrefox")});
+    index->updateItems({"2"}, {item("4", "thunderbird mail"), item("5", "file manager")});
+    REQUIRE(index->saveSnapshot(path));
+
+    auto loaded = make_shared<ItemIndex>("[ ]+", false, 2, 3);
+    REQUIRE(loaded->loadSnapshot(path));
+    for (const auto &query : {"", "fire", "firefix", "web brow", "mail", "xyz"})
+        CHECK(scores(loaded->search(query, true)) == scores(index->search(query, true)));
+
+    // Items are restored without actions until the index got rebuilt
+    auto restored = loaded->search("thunderbird", true);
+    REQUIRE(restored.size() == 1);
+    CHECK(restored[0].item->subtext() == "sub 4");
+    CHECK(restored[0].item->iconUrls() == QStringList{"xdg:4"});
+    CHECK(restored[0].item->actions().empty());
+    loaded->setItems({item("4", "thunderbird mail")});
+    CHECK(restored[0].item->actions().size() == 1);
+    CHECK(loaded->search("fire", true).empty());
+
+    // Writes do not touch the mapped snapshot
+    auto updated = make_shared<ItemIndex>("[ ]+", false, 2, 3);
+    REQUIRE(updated->loadSnapshot(path));
+    updated->updateItems({"1"}, {item("6", "firefly")});
+    index->updateItems({"1"}, {item("6", "firefly")});
+    CHECK(scores(updated->search("fire", true)) == scores(index->search("fire", true)));
+
+    // Snapshots of other configurations, of non empty indices and corrupt files are rejected
+    CHECK(!make_shared<ItemIndex>("[ ]+", false, 2, 0)->loadSnapshot(path));
+    CHECK(!make_shared<ItemIndex>("[ -]+", false, 2, 3)->loadSnapshot(path));
+    CHECK(!index->loadSnapshot(path));
+    CHECK(!make_shared<ItemIndex>("[ ]+", false, 2, 3)->loadSnapshot(dir.filePath("missing.index")));
+    QFile file(path);
+    REQUIRE(file.open(QIODevice::ReadOnly));
+    const auto size = file.size();
+    file.close();
+    REQUIRE(file.resize(size / 2));
+    CHECK(!make_shared<ItemIndex>("[ ]+", false, 2, 3)->loadSnapshot(path));
+}
+
+TEST_CASE("Index concurrent search and update")
+{
+    auto item = [](const QString &id, const QString &string){
+        return IndexItem(make_shared<StandardItem>(id, string), string);
+    };
+
+    auto index = ItemIndex("[ ]+", false, 2, 3);
+    index.setItems({item("persistent", "abc")});
+
+    atomic<bool> done = false;
+    thread writer([&]{
+        for (int i = 0; i < 200; ++i) {
+            index.updateItems({}, {item(QString::number(i), "abc")});
+            if (i % 3 == 0)
+                index.updateItems({QString::number(i)}, {});
+        }
+        done = true;
+    });
+
+    // Searches see consistent snapshots, i.e. the persistent item is always found
+    bool valid = true;
+    size_t searches = 0, failures = 0;
+    do {
+        auto result = index.search("abc", valid);
+        ++searches;
+        if (none_of(result.begin(), result.end(), [](const RankItem &r){ return r.item->id() == "persistent"; }))
+            ++failures;
+    } while (!done);
+    writer.join();
+
+    CHECK(searches > 0);
+    CHECK(failures == 0);
+    CHECK(index.search("abc", valid).size() == 1 + 200 - 67);
+}
+
+TEST_CASE("Benchmark index construction")
+{
+    srand(0);
+    vector<QString> strings;
+    for (int i = 0; i < 100000; ++i)
+        strings.emplace_back(QString::fromStdString(gen_random(rand() % 8 + 1) + " "
+                                                    + gen_random(rand() % 8 + 1) + " "
+                                                    + gen_random(rand() % 8 + 1)));
+    vector<shared_ptr<StandardItem>> items;
+    for (const auto &string : strings)
+        items.emplace_back(make_shared<StandardItem>(string));
+
+    auto thread_pool = QThreadPool::globalInstance();
+    const auto max_thread_count = thread_pool->maxThreadCount();
+
+    auto build = [&](ItemIndex &index){
+        vector<IndexItem> index_items;
+        for (size_t i = 0; i < strings.size(); ++i)
+            index_items.emplace_back(items[i], strings[i]);
+        auto start = system_clock::now();
+        index.setItems(::move(index_items));
+        return duration_cast<milliseconds>(system_clock::now()-start).count();
+    };
+
+    auto sorted = [](vector<RankItem> &&rank_items){
+        sort(rank_items.begin(), rank_items.end(),
+             [](const auto &l, const auto &r){ return l.item.get() < r.item.get(); });
+        return rank_items;
+    };
+
+    thread_pool->setMaxThreadCount(1);
+    auto reference = ItemIndex("[ ]+", false, 2, 4);
+    auto duration_single = build(reference);
+    cout << "Index construction threads: " << setw(3) << 1 << " " << setw(6) << duration_single << " ms." << endl;
+
+    for (int thread_count = 2; thread_count <= max(4, QThreadPool::idealThreadCount()); thread_count *= 2) {
+        thread_pool->setMaxThreadCount(thread_count);
+        auto index = ItemIndex("[ ]+", false, 2, 4);
+        auto duration = build(index);
+        cout << "Index construction threads: " << setw(3) << thread_count << " " << setw(6) << duration
+             << " ms. Speedup: " << duration_single/(float)duration << endl;
+
+        // Same results as the single threaded build
+        bool valid = true;
+        for (const auto &query : {"a", "ab", "abc", "aBc dE", "x0"}) {
+            auto l = sorted(reference.search(query, valid));
+            auto r = sorted(index.search(query, valid));
+            REQUIRE(l.size() == r.size());
+            for (size_t i = 0; i < l.size(); ++i){
+                CHECK(l[i].item == r[i].item);
+                CHECK(l[i].score == r[i].score);
+            }
+        }
+    }
+
+    thread_pool->setMaxThreadCount(max_thread_count);
+}
+
+static const char *separators = R"R([\s\\\/\-\[\](){}#!?<>"'=+*.:,;_]+)R";
+
+TEST_CASE("Tokenizer")
+{
+    auto split = [](const QString &pattern, const QString &string){
+        Tokenizer tokenizer(pattern, false);
+        QString buffer;
+        vector<QStringView> words;
+        tokenizer.tokenize(string, buffer, words);
+        QStringList result;
+        for (const auto &word : words)
+            result << word.toString();
+        return result;
+    };
+
+    CHECK(Tokenizer(separators, false).usesLookupTable());
+    CHECK(Tokenizer("[ ]+", false).usesLookupTable());
+    CHECK(Tokenizer("[a-c_]", false).usesLookupTable());
+    CHECK(!Tokenizer("(?: )+", false).usesLookupTable());
+    CHECK(!Tokenizer("[^a]+", false).usesLookupTable());
+    CHECK(!Tokenizer(R"([\d]+)", false).usesLookupTable());
+    CHECK(!Tokenizer("[ ]+x", false).usesLookupTable());
+
+    CHECK(split("[ ]+", "  Foo  bar ") == QStringList{"foo", "bar"});
+    CHECK(split("[a-c]+", "xaybbz") == QStringList{"x", "y", "z"});
+    CHECK(split("[ ]+", "") == QStringList{});
+    CHECK(split("(?: )+", "  Foo  bar ") == QStringList{"foo", "bar"});
+
+    // \s is ASCII whitespace, like in the regex without unicode properties
+    const QString spaces = QString("a\tb\vc%1d%2e%3f").arg(QChar(0xA0)).arg(QChar(0x2003)).arg(QChar(0x85));
+    CHECK(split(R"([\s]+)", spaces) == spaces.split(QRegularExpression(R"([\s]+)"), Qt::SkipEmptyParts));
+    CHECK(split(R"([\s]+)", spaces) == QStringList{"a", "b", QString("c%1d%2e%3f").arg(QChar(0xA0)).arg(QChar(0x2003)).arg(QChar(0x85))});
+
+    // Lookup table and regex agree with QString::split
+    srand(0);
+    for (int i = 0; i < 1000; ++i) {
+        QString string;
+        for (int c = 0; c < 20; ++c)
+            string += QChar(" -_.:aAbB/\\()[]"[rand() % 15]);
+        auto expected = string.toLower().split(QRegularExpression(separators), Qt::SkipEmptyParts);
+        CHECK(split(separators, string) == expected);
+        CHECK(split(QString("(?:%1)").arg(separators), string) == expected);
+    }
+}
+
+TEST_CASE("Benchmark tokenizer")
+{
+    srand(0);
+    vector<QString> strings;
+    for (int i = 0; i < 50000; ++i)
+        strings.emplace_back(QString::fromStdString(gen_random(rand() % 8 + 1) + " "
+                                                    + gen_random(rand() % 8 + 1) + "-"
+                                                    + gen_random(rand() % 8 + 1) + "."
+                                                    + gen_random(rand() % 3 + 1)));
+    // Behaves the same, but the tokenizer can not build a lookup table for this pattern
+    const auto regex_separators = QString("(?:%1)").arg(separators);
+
+    {
+        Tokenizer table_tokenizer(separators, false);
+        QString buffer;
+        vector<QStringView> words;
+
+        auto start = system_clock::now();
+        size_t regex_word_count = 0;
+        for (const auto &string : strings)
+            regex_word_count += string.toLower().split(QRegularExpression(separators), Qt::SkipEmptyParts).size();
+        long duration_regex = duration_cast<microseconds>(system_clock::now()-start).count();
+
+        start = system_clock::now();
+        size_t table_word_count = 0;
+        for (const auto &string : strings) {
+            table_tokenizer.tokenize(string, buffer, words);
+            table_word_count += words.size();
+        }
+        long duration_table = duration_cast<microseconds>(system_clock::now()-start).count();
+
+        cout << "Tokenize regex split: " << setw(9) << duration_regex << " µs. Lookup table: " << setw(9)
+             << duration_table << " µs. Ratio: " << duration_table/(float)duration_regex << endl;
+        CHECK(regex_word_count == table_word_count);
+    }
+
+    auto items = [&]{
+        vector<IndexItem> index_items;
+        for (const auto &string : strings)
+            index_items.emplace_back(make_shared<StandardItem>(string), string);
+        return index_items;
+    };
+
+    auto regex_index = ItemIndex(regex_separators, false, 2, 4);
+    auto table_index = ItemIndex(separators, false, 2, 4);
+
+    auto start = system_clock::now();
+    regex_index.setItems(items());
+    long duration_regex = duration_cast<milliseconds>(system_clock::now()-start).count();
+
+    start = system_clock::now();
+    table_index.setItems(items());
+    long duration_table = duration_cast<milliseconds>(system_clock::now()-start).count();
+
+    cout << "Index build regex: " << setw(9) << duration_regex << " ms. Lookup table: " << setw(9)
+         << duration_table << " ms. Ratio: " << duration_table/(float)duration_regex << endl;
+
+    // Search every prefix as if typed
+    bool valid = true;
+    vector<QString> queries;
+    for (int i = 0; i < 20; ++i) {
+        const auto &string = strings[rand() % strings.size()];
+        for (int l = 1; l <= string.size(); ++l)
+            queries.emplace_back(string.left(l));
+    }
+
+    size_t regex_result_count = 0, table_result_count = 0;
+    start = system_clock::now();
+    for (const auto &query : queries)
+        regex_result_count += regex_index.search(query, valid).size();
+    duration_regex = duration_cast<microseconds>(system_clock::now()-start).count();
+
+    start = system_clock::now();
+    for (const auto &query : queries)
+        table_result_count += table_index.search(query, valid).size();
+    duration_table = duration_cast<microseconds>(system_clock::now()-start).count();
+
+    cout << "Keystroke search regex: " << setw(9) << duration_regex << " µs. Lookup table: " << setw(9)
+         << duration_table << " µs. Ratio: " << duration_table/(float)duration_regex << endl;
+    CHECK(regex_result_count == table_result_count);
+}
+
+TEST_CASE("Usage scores")
+{
+    vector<Activation> activations{
+        {"q", "e1", "a", ""},
+        {"q", "e1", "b", ""},
+        {"q", "e2", "a", ""},
+        {"q", "e1", "b", ""},
+    };
+    UsageScores scores(activations, 0.5);
+
+    CHECK(scores.size() == 3);
+    REQUIRE(scores.score("e1", "b"));
+    REQUIRE(scores.score("e2", "a"));
+    REQUIRE(scores.score("e1", "a"));
+    CHECK(*scores.score("e1", "b") > *scores.score("e2", "a"));
+    CHECK(*scores.score("e2", "a") > *scores.score("e1", "a"));
+    CHECK(scores.score("e2", "b") == nullptr);
+    CHECK(scores.score("e3", "a") == nullptr);
+
+    vector<RankItem> rank_items{
+        RankItem(make_shared<StandardItem>("a", "aaaa"), 1.0f),  // recent perfect match
+        RankItem(make_shared<StandardItem>("b", "bbbb"), 0.5f),  // recent match
+        RankItem(make_shared<StandardItem>("c", "cccc"), 1.0f),  // perfect match
+        RankItem(make_shared<StandardItem>("d", "dddd"), 0.5f),  // match
+        RankItem(make_shared<StandardItem>("e", "eeee"), 0.0f),  // no match
+    };
+    scores.apply("e1", rank_items, true);
+    CHECK(rank_items[0].score == 3.0f + *scores.score("e1", "a"));
+    CHECK(rank_items[1].score == 1.0f + *scores.score("e1", "b"));
+    CHECK(rank_items[2].score == 2.25f);
+    CHECK(rank_items[3].score == 0.5f);
+    CHECK(rank_items[4].score == -0.75f);
+}
+
+TEST_CASE("Usage weights")
+{
+    vector<Activation> activations;
+    for (int i = 0; i < 5000; ++i)
+        activations.emplace_back("query", QString("e%1").arg(rand() % 3), QString("i%1").arg(rand() % 50), "");
+
+    for (double memory_decay : {0.5, 0.99, 1.0}) {
+        // Folding activations one by one equals the batch computation
+        UsageWeights incremental({}, memory_decay);
+        for (size_t n = 0; n < activations.size(); ++n) {
+            incremental.add(activations[n].extension_id, activations[n].item_id);
+            if (n % 1000 != 999)
+                continue;
+
+            UsageWeights batch(vector<Activation>(activations.begin(), activations.begin() + n + 1), memory_decay);
+            for (size_t k = n - 10; k <= n; ++k) {
+                const auto &a = activations[k];
+                auto w = incremental.weight(a.extension_id, a.item_id);
+                CHECK(w == doctest::Approx(batch.weight(a.extension_id, a.item_id)));
+
+                // Weights are the decayed activation counts, i.e. sum decay^age
+                double expected = 0;
+                for (size_t j = 0; j <= n; ++j)
+                    if (activations[j].extension_id == a.extension_id && activations[j].item_id == a.item_id)
+                        expected += pow(memory_decay, n + 1 - j);
+                CHECK(w == doctest::Approx(expected));
+            }
+        }
+        CHECK(incremental.weight("e0", "none") == 0.0);
+
+        // Restoring aggregated weights and folding the rest equals folding all
+        UsageWeights aggregate(vector<Activation>(activations.begin(), activations.begin() + 4000), memory_decay);
+        UsageWeights compacted({}, memory_decay);
+        aggregate.forEach([&](const QString &e, const QString &i, double w){ compacted.addWeight(e, i, w); });
+        for (size_t n = 4000; n < activations.size(); ++n)
+            compacted.add(activations[n].extension_id, activations[n].item_id);
+        incremental.forEach([&](const QString &e, const QString &i, double w){
+            CHECK(compacted.weight(e, i) == doctest::Approx(w));
+        });
+    }
+}
+
+TEST_CASE("Benchmark usage scores")
+{
+    // The former implementation for comparison
+    auto legacy_apply = [](const map<pair<QString,QString>,float> &usage_scores,
+                           const QString &extension_id, vector<RankItem> &rank_items){
+        for (auto &rank_item : rank_items)
+            if (rank_item.score == 1.0f)
+                try {
+                    rank_item.score = 3.0f + usage_scores.at(make_pair(extension_id, rank_item.item->id()));
+                } catch (const out_of_range &){
+                    rank_item.score = 2.0f + 1.0f / rank_item.item->text().length();
+                }
+            else
+                try {
+                    rank_item.score = 1.0f + usage_scores.at(make_pair(extension_id, rank_item.item->id()));
+                } catch (const out_of_range &){
+                    if (rank_item.score == 0.0f)
+                        rank_item.score = -1.0f + 1.0f / rank_item.item->text().length();
+                }
+    };
+
+    vector<QString> extension_ids;
+    for (int e = 0; e < 20; ++e)
+        extension_ids.emplace_back(QString("extension_%1").arg(e));
+
+    // A few thousand distinct activated items
+    vector<Activation> activations;
+    for (int i = 0; i < 20000; ++i)
+        activations.emplace_back("query", extension_ids[rand() % extension_ids.size()],
+                                 QString("item_%1").arg(rand() % 5000), "action");
+    UsageScores scores(activations, 0.99);
+
+    map<pair<QString,QString>,float> legacy_scores;
+    for (const auto &activation : activations)
+        if (auto s = scores.score(activation.extension_id, activation.item_id))
+            legacy_scores.emplace(make_pair(activation.extension_id, activation.item_id), *s);
+
+    for (size_t result_count : {1000, 20000, 100000}) {
+        vector<RankItem> rank_items;
+        for (size_t i = 0; i < result_count; ++i)
+            rank_items.emplace_back(make_shared<StandardItem>(QString("item_%1").arg(rand() % 50000), "text"),
+                                    (float)(rand() % 3) / 2);
+        auto legacy_rank_items = rank_items;
+
+        auto start = system_clock::now();
+        legacy_apply(legacy_scores, extension_ids[0], legacy_rank_items);
+        auto duration_legacy = duration_cast<microseconds>(system_clock::now()-start).count();
+
+        start = system_clock::now();
+        scores.apply(extension_ids[0], rank_items, true);
+        auto duration = duration_cast<microseconds>(system_clock::now()-start).count();
+
+        cout << "Apply usage scores to " << setw(6) << result_count << " items. Legacy: "
+             << setw(7) << duration_legacy << " µs. Hashed: " << setw(7) << duration << " µs ("
+             << duration/(float)duration_legacy << ")" << endl;
+
+        for (size_t i = 0; i < result_count; ++i)
+            CHECK(rank_items[i].score == legacy_rank_items[i].score);
+    }
+}
+
+TEST_CASE("IconProvider cache")
+{
+    // Pixmaps require a gui application
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    int argc = 1;
+    char arg0[] = "albert_test";
+    char *argv[] = {arg0, nullptr};
+    QApplication app(argc, argv);
+
+    IconProvider provider;
+    CHECK(provider.cacheLimit() == 64 * 1024 * 1024);
+
+    QSize size;
+    auto get = [&](int i, QSize s = QSize(16, 16)){
+        return provider.getPixmap(QString("gen:?text=%1").arg(i), &size, s);
+    };
+
+    CHECK(!get(0).isNull());
+    auto statistics = provider.cacheStatistics();
+    CHECK(statistics.hits == 0);
+    CHECK(statistics.misses == 1);
+    CHECK(statistics.count == 1);
+    const auto cost = statistics.size;  // Equal for all urls below
+    CHECK(cost > 16 * 16);
+
+    // Room for three entries. Accessing 0 makes 1 the least recently used.
+    provider.setCacheLimit(3 * cost);
+    get(1);
+    get(2);
+    get(0);
+    statistics = provider.cacheStatistics();
+    CHECK(statistics.hits == 1);
+    CHECK(statistics.misses == 3);
+    CHECK(statistics.evictions == 0);
+    CHECK(statistics.count == 3);
+    CHECK(statistics.size == 3 * cost);
+
+    // Exceeding the limit evicts the least recently used entry
+    get(3);
+    statistics = provider.cacheStatistics();
+    CHECK(statistics.misses == 4);
+    CHECK(statistics.evictions == 1);
+    CHECK(statistics.count == 3);
+    CHECK(statistics.size == 3 * cost);
+
+    get(0);
+    get(2);
+    get(3);
+    CHECK(provider.cacheStatistics().hits == 4);
+    CHECK(provider.cacheStatistics().misses == 4);
+
+    get(1);  // Evicted, evicts 0
+    statistics = provider.cacheStatistics();
+    CHECK(statistics.misses == 5);
+    CHECK(statistics.evictions == 2);
+    get(2);
+    CHECK(provider.cacheStatistics().hits == 5);
+
+    // Sizes are cached separately
+    get(2, QSize(8, 8));
+    CHECK(provider.cacheStatistics().misses == 6);
+
+    // Lowering the limit evicts immediately
+    provider.setCacheLimit(cost);
+    statistics = provider.cacheStatistics();
+    CHECK(statistics.count == 1);
+    CHECK(statistics.size <= cost);
+    CHECK(statistics.evictions == 5);
+
+    provider.clearCache();
+    statistics = provider.cacheStatistics();
+    CHECK(statistics.count == 0);
+    CHECK(statistics.size == 0);
+    CHECK(statistics.evictions == 5);
+}
+
+#if defined(Q_OS_LINUX)
+TEST_CASE("Benchmark XDG icon lookup")
+{
+    QTemporaryDir icon_dir;
+    REQUIRE(icon_dir.isValid());
+    QDir base(icon_dir.path());
+
+    auto touch = [](const QString &path){
+        QFile file(path);
+        REQUIRE(file.open(QIODevice::WriteOnly));
+    };
+
+    // A synthetic theme of the usual shape: sizes × contexts × types
+    const QStringList contexts{"actions", "apps", "categories", "devices", "emblems",
+                               "mimetypes", "places", "status"};
+    const vector<int> sizes{16, 22, 24, 32, 48, 64, 128};
+    QStringList directories;
+    QString theme_file = "[Icon Theme]\nName=Test\nInherits=hicolor\n";
+    QString directory_groups;
+    for (const auto &context : contexts) {
+        for (int size : sizes) {
+            const auto directory = QString("%1x%1/%2").arg(size).arg(context);
+            directories << directory;
+            directory_groups += QString("\n[%1]\nSize=%2\nType=%3\n%4")
+                .arg(directory).arg(size).arg(size < 32 ? "Fixed" : "Threshold")
+                .arg(size < 32 ? "" : "Threshold=4\n");
+        }
+        const auto directory = QString("scalable/%1").arg(context);
+        directories << directory;
+        directory_groups += QString("\n[%1]\nSize=64\nMinSize=8\nMaxSize=512\nType=Scalable\n")
+            .arg(directory);
+    }
+    theme_file += QString("Directories=%1\n").arg(directories.join(',')) + directory_groups;
+
+    REQUIRE(base.mkpath("test"));
+    {
+        QFile file(base.filePath("test/index.theme"));
+        REQUIRE(file.open(QIODevice::WriteOnly));
+        file.write(theme_file.toUtf8());
+    }
+    for (const auto &directory : directories)
+        REQUIRE(base.mkpath("test/" + directory));
+
+    // Every icon in one context, in a few sizes, some scalable only
+    const int icon_count = 2000;
+    for (int i = 0; i < icon_count; ++i) {
+        const auto &context = contexts[i % contexts.size()];
+        if (i % 5 == 0)
+            touch(base.filePath(QString("test/scalable/%1/icon_%2.svg").arg(context).arg(i)));
+        else
+            for (int size : {16, 32, 48})
+                touch(base.filePath(QString("test/%1x%1/%2/icon_%3.png").arg(size).arg(context).arg(i)));
+    }
+
+    // A parent theme and an unsorted icon
+    REQUIRE(base.mkpath("hicolor/48x48/apps"));
+    {
+        QFile file(base.filePath("hicolor/index.theme"));
+        REQUIRE(file.open(QIODevice::WriteOnly));
+        file.write("[Icon Theme]\nName=Hicolor\nDirectories=48x48/apps\n\n[48x48/apps]\nSize=48\nType=Fixed\n");
+    }
+    touch(base.filePath("hicolor/48x48/apps/parent_icon.png"));
+    touch(base.filePath("unsorted_icon.xpm"));
+
+    XDG::IconLookup lookup({icon_dir.path()}, QString());
+
+    auto start = system_clock::now();
+    CHECK(lookup.themeIconPath("icon_1", 16, "test") == base.filePath("test/16x16/apps/icon_1.png"));
+    auto duration = duration_cast<microseconds>(system_clock::now()-start).count();
+    cout << "XDG icon lookup, theme indexing: " << setw(7) << duration << " µs" << endl;
+
+    // Size matching
+    CHECK(lookup.themeIconPath("icon_1", 0, "test") == base.filePath("test/48x48/apps/icon_1.png"));
+    CHECK(lookup.themeIconPath("icon_1", 30, "test") == base.filePath("test/32x32/apps/icon_1.png"));  // Threshold
+    CHECK(lookup.themeIconPath("icon_1", 40, "test") == base.filePath("test/32x32/apps/icon_1.png"));  // Closest
+    CHECK(lookup.themeIconPath("icon_1", 100, "test") == base.filePath("test/48x48/apps/icon_1.png"));
+    CHECK(lookup.themeIconPath("icon_0.svg", 256, "test") == base.filePath("test/scalable/actions/icon_0.svg"));
+    CHECK(lookup.themeIconPath("parent_icon", 32, "test") == base.filePath("hicolor/48x48/apps/parent_icon.png"));
+    CHECK(lookup.themeIconPath("unsorted_icon", 32, "test") == base.filePath("unsorted_icon.xpm"));
+    CHECK(lookup.themeIconPath("missing_icon", 32, "test").isEmpty());
+
+    // Hits and misses of various sizes
+    const int lookups = 8000;
+    int found = 0;
+    start = system_clock::now();
+    for (int i = 0; i < lookups; ++i)
+        if (!lookup.themeIconPath(QString("icon_%1").arg(i % (2 * icon_count)), sizes[i % sizes.size()], "test").isEmpty())
+            ++found;
+    duration = duration_cast<microseconds>(system_clock::now()-start).count();
+    cout << "XDG icon lookup, " << lookups << " lookups: " << setw(7) << duration << " µs ("
+         << duration / (float)lookups << " µs/lookup)" << endl;
+    CHECK(found == lookups / 2);
+
+    // Icons added to or removed from a theme subdirectory are reflected after
+    // a restart. Misses are not persisted, hits are validated by the stamp.
+    QTemporaryDir cache_dir;
+    REQUIRE(cache_dir.isValid());
+    const auto cache_file = QDir(cache_dir.path()).filePath("iconlookup.cache");
+    {
+        XDG::IconLookup cached_lookup({icon_dir.path()}, cache_file);
+        CHECK(cached_lookup.themeIconPath("icon_1", 16, "test") == base.filePath("test/16x16/apps/icon_1.png"));
+        CHECK(cached_lookup.themeIconPath("new_icon", 48, "test").isEmpty());
+    }
+    this_thread::sleep_for(milliseconds(20));  // Beyond the mtime granularity
+    touch(base.filePath("hicolor/48x48/apps/new_icon.png"));
+    {
+        XDG::IconLookup cached_lookup({icon_dir.path()}, cache_file);
+        CHECK(cached_lookup.themeIconPath("icon_1", 16, "test") == base.filePath("test/16x16/apps/icon_1.png"));
+        CHECK(cached_lookup.themeIconPath("new_icon", 48, "test") == base.filePath("hicolor/48x48/apps/new_icon.png"));
+    }
+    this_thread::sleep_for(milliseconds(20));
+    REQUIRE(QFile::remove(base.filePath("hicolor/48x48/apps/new_icon.png")));
+    {
+        XDG::IconLookup cached_lookup({icon_dir.path()}, cache_file);
+        CHECK(cached_lookup.themeIconPath("new_icon", 48, "test").isEmpty());
+    }
+}
+#endif